@@ -60,6 +60,7 @@ class Application : public Gtk::Application {
   bool running_as_service = false;
 
   void create_actions();
+  void generate_fftw_wisdom();
   void update_bypass_state(const std::string& key);
 };
 
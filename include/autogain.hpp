@@ -35,6 +35,10 @@ class AutoGain : public PluginBase {
 
   sigc::signal<void, float> momentary, shortterm, integrated, relative, loudness, range, gain;
 
+  // the loudness history of each device is kept apart and restored when it is used again
+
+  void set_history_id(const std::string& id);
+
  private:
   void bind_to_gsettings();
 };
@@ -45,7 +45,7 @@ class AutoGainUi : public Gtk::Grid, public PluginUiBase {
   void reset() override;
 
  private:
-  Glib::RefPtr<Gtk::Adjustment> input_gain, output_gain, target, weight_m, weight_s, weight_i;
+  Glib::RefPtr<Gtk::Adjustment> input_gain, output_gain, target, ceiling, weight_m, weight_s, weight_i;
 
   Gtk::LevelBar *m_level = nullptr, *s_level = nullptr, *i_level = nullptr, *r_level = nullptr, *g_level = nullptr,
                 *l_level = nullptr, *lra_level = nullptr;
@@ -55,9 +55,9 @@ class AutoGainUi : public Gtk::Grid, public PluginUiBase {
 
   Gtk::Button* reset_history = nullptr;
 
-  Gtk::ToggleButton *detect_silence = nullptr, *use_geometric_mean = nullptr;
+  Gtk::ToggleButton *detect_silence = nullptr, *use_geometric_mean = nullptr, *use_limiter = nullptr;
 
-  Gtk::Grid *weight_m_grid = nullptr, *weight_s_grid = nullptr, *weight_i_grid = nullptr;
+  Gtk::Grid *weight_m_grid = nullptr, *weight_s_grid = nullptr, *weight_i_grid = nullptr, *ceiling_grid = nullptr;
 };
 
 #endif
@@ -31,7 +31,7 @@ class Convolver : public PluginBase {
   auto operator=(const Convolver&&) -> Convolver& = delete;
   ~Convolver() override;
 
-  GstElement *convolver = nullptr, *adapter = nullptr;
+  GstElement* convolver = nullptr;
 
  private:
   void bind_to_gsettings();
@@ -20,15 +20,14 @@
 #ifndef CONVOLVER_UI_HPP
 #define CONVOLVER_UI_HPP
 
+#include <glibmm/dispatcher.h>
 #include <glibmm/i18n.h>
-#include <gst/fft/gstfftf32.h>
 #include <boost/filesystem.hpp>
-#include <boost/math/interpolators/cardinal_cubic_b_spline.hpp>
-#include <future>
-#include <mutex>
+#include <memory>
 #include <sndfile.hh>
 #include "glibmm/main.h"
 #include "glibmm/miscutils.h"
+#include "irs_analyzer.hpp"
 #include "plugin_ui_base.hpp"
 #include "sigc++/functors/ptr_fun.h"
 
@@ -49,7 +48,7 @@ class ConvolverUi : public Gtk::Grid, public PluginUiBase {
  private:
   std::string log_tag = "convolver_ui: ";
 
-  Glib::RefPtr<Gtk::Adjustment> input_gain, output_gain, ir_width;
+  Glib::RefPtr<Gtk::Adjustment> input_gain, output_gain, ir_width, tail_threshold;
 
   Gtk::ListBox* irs_listbox = nullptr;
 
@@ -62,10 +61,12 @@ class ConvolverUi : public Gtk::Grid, public PluginUiBase {
   Gtk::DrawingArea *left_plot = nullptr, *right_plot = nullptr;
 
   Gtk::Label *label_file_name = nullptr, *label_sampling_rate = nullptr, *label_samples = nullptr,
-             *label_duration = nullptr;
+             *label_duration = nullptr, *label_effective_length = nullptr, *label_cpu_saving = nullptr;
 
   Gtk::ToggleButton* show_fft = nullptr;
 
+  Gtk::ComboBoxText* partitioning = nullptr;
+
   Pango::FontDescription font;
 
   boost::filesystem::path irs_dir;
@@ -79,12 +80,13 @@ class ConvolverUi : public Gtk::Grid, public PluginUiBase {
   float fft_max_freq = 0.0F, fft_min_freq = 0.0F;
   std::vector<float> left_mag, right_mag, time_axis;
   std::vector<float> left_spectrum, right_spectrum, freq_axis;
+  std::vector<float> edc;
 
   Glib::RefPtr<Gio::Settings> spectrum_settings;
 
-  std::mutex lock_guard_irs_info;
+  Glib::Dispatcher analysis_dispatcher;  // wakes up this thread when the analyzer has results
 
-  std::vector<std::future<void>> futures;
+  std::unique_ptr<IrsAnalyzer> irs_analyzer;
 
   auto get_irs_names() -> std::vector<std::string>;
 
@@ -100,9 +102,13 @@ class ConvolverUi : public Gtk::Grid, public PluginUiBase {
 
   void on_import_irs_clicked();
 
-  void get_irs_info();
+  void show_irs_info(const std::string& path);
+
+  void apply_irs_analysis(const std::string& path, const std::shared_ptr<const IrsAnalysis>& analysis);
+
+  static auto get_irs_description(const IrsAnalysis& analysis) -> std::string;
 
-  void get_irs_spectrum(const int& rate);
+  void update_tail_info();
 
   void draw_channel(Gtk::DrawingArea* da,
                     const Cairo::RefPtr<Cairo::Context>& ctx,
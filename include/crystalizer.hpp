@@ -33,10 +33,12 @@ class Crystalizer : public PluginBase {
 
   GstElement *crystalizer = nullptr, *adapter = nullptr;
 
-  sigc::connection range_before_connection, range_after_connection;
+  sigc::connection range_before_connection, range_after_connection, bands_connection;
 
   sigc::signal<void, double> range_before, range_after;
 
+  void update_bands();
+
  private:
   void bind_to_gsettings();
 };
@@ -46,6 +46,7 @@ class CrystalizerUi : public Gtk::Grid, public PluginUiBase {
   Gtk::LevelBar *range_before = nullptr, *range_after = nullptr;
   Gtk::Label *range_before_label = nullptr, *range_after_label = nullptr;
   Gtk::ToggleButton* aggressive = nullptr;
+  Gtk::ComboBoxText* crossover = nullptr;
 
   Glib::RefPtr<Gtk::Adjustment> input_gain, output_gain;
 
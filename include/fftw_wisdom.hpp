@@ -0,0 +1,57 @@
+/*
+ *  Copyright © 2017-2020 Wellington Wallace
+ *
+ *  This file is part of PulseEffects.
+ *
+ *  PulseEffects is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  PulseEffects is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with PulseEffects.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef FFTW_WISDOM_HPP
+#define FFTW_WISDOM_HPP
+
+#include <string>
+
+/*
+  zita-convolver plans its ffts with FFTW_ESTIMATE because measuring them while the pipeline is being built is too
+  slow. FFTW uses wisdom of any rigor when planning with FFTW_ESTIMATE, so if we measure the sizes zita uses once and
+  import the result every Convproc instance gets measured plans for free.
+*/
+
+namespace fftw_wisdom {
+
+auto get_wisdom_file() -> std::string;
+
+auto wisdom_file_exists() -> bool;
+
+/*
+  The automatic generation is only tried once. If it fails it is not started again at every launch. The user can
+  still run it with --generate-wisdom.
+*/
+
+auto generation_attempted() -> bool;
+
+void mark_generation_attempt();
+
+/*
+  Makes the fftw planner thread safe and imports the wisdom file into the process. It is done only once and must
+  happen before zita or the crystalizer create their plans.
+*/
+void load();
+
+// Measures the plans for all the partition sizes zita may use and saves them. It can take a few seconds.
+auto generate() -> bool;
+
+}  // namespace fftw_wisdom
+
+#endif
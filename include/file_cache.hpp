@@ -0,0 +1,166 @@
+/*
+ *  Copyright © 2017-2020 Wellington Wallace
+ *
+ *  This file is part of PulseEffects.
+ *
+ *  PulseEffects is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  PulseEffects is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with PulseEffects.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef FILE_CACHE_HPP
+#define FILE_CACHE_HPP
+
+#include <fcntl.h>
+#include <glib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <vector>
+#include "util.hpp"
+
+/*
+  Helpers shared by the caches kept in the user cache dir. An entry is one file named after the hash of its key. The
+  key is also stored inside the file so that the reader can detect hash collisions. Each cache validates its own
+  header.
+*/
+
+namespace file_cache {
+
+inline auto get_dir(const std::string& name) -> std::string {
+  return std::string(g_get_user_cache_dir()) + "/PulseEffects/" + name;
+}
+
+inline auto get_file(const std::string& name, const std::string& key, const std::string& extension) -> std::string {
+  char hash[32];
+
+  snprintf(hash, sizeof(hash), "%016zx", std::hash<std::string>{}(key));
+
+  return get_dir(name) + "/" + hash + extension;
+}
+
+/*
+  The writer fills a temporary file made by g_mkstemp, which is then renamed to the entry. This way other instances
+  reading the cache at the same time never see an incomplete file and two writers never share a temporary file.
+*/
+
+inline auto write(const std::string& name, const std::string& file, const std::function<bool(FILE*)>& writer)
+    -> bool {
+  auto dir = get_dir(name);
+
+  if (g_mkdir_with_parents(dir.c_str(), 0755) != 0) {
+    util::warning("could not create the cache directory: " + dir);
+
+    return false;
+  }
+
+  auto tmp_file = file + ".XXXXXX";
+
+  int fd = g_mkstemp(tmp_file.data());
+
+  if (fd < 0) {
+    util::warning("could not create the cache file: " + tmp_file);
+
+    return false;
+  }
+
+  FILE* f = fdopen(fd, "wb");
+
+  bool ok = f != nullptr && writer(f);
+
+  if (f != nullptr) {
+    ok = (fclose(f) == 0) && ok;
+  } else {
+    close(fd);
+  }
+
+  if (ok && rename(tmp_file.c_str(), file.c_str()) == 0) {
+    return true;
+  }
+
+  unlink(tmp_file.c_str());
+
+  util::warning("could not write the cache file: " + file);
+
+  return false;
+}
+
+// marks an entry as recently used. trim removes the entries that were not used for the longest time
+
+inline void touch(const std::string& file) {
+  utimensat(AT_FDCWD, file.c_str(), nullptr, 0);
+}
+
+// removes the least recently used entries with this extension until the directory holds at most max_bytes
+
+inline void trim(const std::string& name, const std::string& extension, const uint64_t& max_bytes) {
+  auto dir = get_dir(name);
+
+  GDir* d = g_dir_open(dir.c_str(), 0, nullptr);
+
+  if (d == nullptr) {
+    return;
+  }
+
+  struct Entry {
+    std::string file;
+    int64_t mtime;
+    uint64_t size;
+  };
+
+  std::vector<Entry> entries;
+  uint64_t total = 0U;
+
+  while (const gchar* file_name = g_dir_read_name(d)) {
+    if (!g_str_has_suffix(file_name, extension.c_str())) {
+      continue;
+    }
+
+    auto file = dir + "/" + file_name;
+
+    struct stat st {};
+
+    if (stat(file.c_str(), &st) == 0) {
+      entries.emplace_back(Entry{file, static_cast<int64_t>(st.st_mtim.tv_sec), static_cast<uint64_t>(st.st_size)});
+
+      total += st.st_size;
+    }
+  }
+
+  g_dir_close(d);
+
+  if (total <= max_bytes) {
+    return;
+  }
+
+  std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) { return a.mtime < b.mtime; });
+
+  for (auto& e : entries) {
+    if (total <= max_bytes) {
+      break;
+    }
+
+    if (unlink(e.file.c_str()) == 0) {
+      total -= e.size;
+
+      util::debug("removed the cache file " + e.file + " to keep " + dir + " below its size limit");
+    }
+  }
+}
+
+}  // namespace file_cache
+
+#endif
@@ -0,0 +1,164 @@
+/*
+ *  Copyright © 2017-2020 Wellington Wallace
+ *
+ *  This file is part of PulseEffects.
+ *
+ *  PulseEffects is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  PulseEffects is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with PulseEffects.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef IRS_ANALYZER_HPP
+#define IRS_ANALYZER_HPP
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+  Everything the convolver interface shows about an impulse response. The curves are already reduced to the number
+  of points we plot and rescaled between 0 and 1.
+*/
+
+struct IrsAnalysis {
+  int64_t mtime = 0;  // modification time of the file when it was analyzed
+
+  uint rate = 0U, channels = 0U, frames = 0U;
+
+  float duration = 0.0F;
+
+  // waveform envelope. Each plot column has its minimum followed by its maximum
+
+  float min_left = 0.0F, max_left = 0.0F, min_right = 0.0F, max_right = 0.0F;
+
+  std::vector<float> time_axis, left_mag, right_mag;
+
+  // magnitude spectrum on a logarithmic frequency axis
+
+  float fft_min_left = 0.0F, fft_max_left = 0.0F, fft_min_right = 0.0F, fft_max_right = 0.0F;
+
+  float fft_min_freq = 0.0F, fft_max_freq = 0.0F;
+
+  std::vector<float> freq_axis, left_spectrum, right_spectrum;
+
+  // energy decay curve of all channels in dB. There is one point at the start of each plot column
+
+  std::vector<float> edc;
+};
+
+/*
+  Analyzes impulse response files in a single worker thread. Results are kept in the user cache dir so that a file
+  is analyzed only once while it is not modified. The most recently used ones are also kept in memory.
+*/
+
+class IrsAnalyzer {
+ public:
+  /*
+    notify is called from the worker thread when a request is done. It must only wake up the thread that reads the
+    results with take_results.
+  */
+
+  IrsAnalyzer(const uint& max_points, std::function<void()> notify);
+  IrsAnalyzer(const IrsAnalyzer&) = delete;
+  auto operator=(const IrsAnalyzer&) -> IrsAnalyzer& = delete;
+  IrsAnalyzer(const IrsAnalyzer&&) = delete;
+  auto operator=(const IrsAnalyzer&&) -> IrsAnalyzer& = delete;
+  ~IrsAnalyzer();
+
+  /*
+    Requests done since the previous call, in the order they were done. The analysis is null if the file could not be
+    read.
+  */
+
+  auto take_results() -> std::vector<std::pair<std::string, std::shared_ptr<const IrsAnalysis>>>;
+
+  // Returns the analysis kept in memory or null if there is none for the current version of the file.
+
+  auto lookup(const std::string& path) -> std::shared_ptr<const IrsAnalysis>;
+
+  /*
+    Queues the file. An urgent request goes in front of the queue and replaces the previous urgent one that was not
+    started yet. The others are analyzed when there is nothing urgent to do.
+  */
+
+  void request(const std::string& path, const bool& urgent);
+
+ private:
+  std::string log_tag = "irs_analyzer: ";
+
+  uint max_points;
+
+  bool quit = false;
+
+  std::string urgent_path;
+
+  std::deque<std::string> queue;
+
+  struct CacheEntry {
+    std::shared_ptr<const IrsAnalysis> analysis;
+
+    uint64_t last_use = 0U;
+  };
+
+  std::map<std::string, CacheEntry> cache;
+
+  uint64_t use_count = 0U;
+
+  std::vector<std::pair<std::string, std::shared_ptr<const IrsAnalysis>>> results;
+
+  std::function<void()> notify;
+
+  std::mutex mutex;
+
+  std::condition_variable cv;
+
+  std::thread worker;
+
+  void work();
+
+  // the two below must be called with the mutex locked
+
+  auto find_cached(const std::string& path, const int64_t& mtime) -> std::shared_ptr<const IrsAnalysis>;
+
+  void store_cached(const std::string& path, const std::shared_ptr<const IrsAnalysis>& analysis);
+
+  auto analyze(const std::string& path, const int64_t& mtime) -> std::shared_ptr<IrsAnalysis>;
+
+  void get_envelope(const std::vector<float>& signal, std::vector<float>& envelope, float& min_v, float& max_v);
+
+  static void get_edc(const std::vector<float>& kernel,
+                      const uint& channels,
+                      const uint& n_columns,
+                      std::vector<float>& edc);
+
+  void get_spectrum(const std::vector<float>& signal,
+                    const uint& rate,
+                    const std::vector<float>& freq_axis,
+                    std::vector<float>& spectrum,
+                    float& min_v,
+                    float& max_v);
+
+  static auto get_cache_file(const std::string& path) -> std::string;
+
+  auto load_from_disk(const std::string& path, const int64_t& mtime) -> std::shared_ptr<IrsAnalysis>;
+
+  void save_to_disk(const std::string& path, const IrsAnalysis& analysis);
+};
+
+#endif
@@ -0,0 +1,168 @@
+/*
+ *  Copyright © 2017-2020 Wellington Wallace
+ *
+ *  This file is part of PulseEffects.
+ *
+ *  PulseEffects is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  PulseEffects is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with PulseEffects.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef LOUDNESS_ANALYZER_HPP
+#define LOUDNESS_ANALYZER_HPP
+
+#include <ebur128.h>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "util.hpp"
+
+// EBU R128 values of one tap. The levels are in LUFS and the range in LU. Those the tap is not read for stay at 0
+
+struct LoudnessSnapshot {
+  float momentary = 0.0F;
+  float shortterm = 0.0F;
+  float global = 0.0F;
+  float relative = 0.0F;
+  float range = 0.0F;
+
+  uint blocks = 0U;      // 100 ms blocks above the absolute gate since the last reset
+  uint generation = 0U;  // number of resets the values take into account
+
+  bool valid = false;  // false until the first frames are analyzed and while frames are being dropped
+};
+
+/*
+  EBU R128 analysis done in a low priority thread. Each tap is a point of the signal that is measured. The streaming
+  thread only copies its frames to a single producer single consumer ring buffer. Every 100 ms the analysis thread
+  feeds them to libebur128 and publishes the momentary, short term, integrated, relative threshold and loudness range
+  values the tap is read for. Readers get a consistent copy of them through a sequence lock, so the analysis thread
+  never waits for them. A reader that meets a publication in progress either tries again or keeps the values it
+  already has. If the analysis falls behind, the frames that do not fit in the ring are dropped and counted. The
+  analysis thread reports each burst of them once in the log. The snapshots published while frames are lost are not
+  valid.
+*/
+
+class LoudnessAnalyzer {
+ public:
+  // values a tap is read for. The relative threshold comes with the integrated loudness
+
+  enum Value : uint { momentary = 1U, shortterm = 2U, integrated = 4U, range = 8U };
+
+  /*
+    One tap per entry of values. Each entry is a combination of Value flags and libebur128 only does the work they
+    need. max_history is the length in ms of the history kept by libebur128. 0 keeps all of it.
+  */
+
+  LoudnessAnalyzer(const std::string& tag, const std::vector<uint>& values, const uint& max_history = 0U);
+  LoudnessAnalyzer(const LoudnessAnalyzer&) = delete;
+  auto operator=(const LoudnessAnalyzer&) -> LoudnessAnalyzer& = delete;
+  LoudnessAnalyzer(const LoudnessAnalyzer&&) = delete;
+  auto operator=(const LoudnessAnalyzer&&) -> LoudnessAnalyzer& = delete;
+  ~LoudnessAnalyzer();
+
+  /*
+    Called from the streaming thread when the sampling rate is known. The analysis thread is started on the first
+    call. The measurement starts again when the rate changes.
+  */
+
+  void set_rate(const int& value);
+
+  // nsamples interleaved stereo frames. They are copied. Nothing is allocated
+
+  void push(const uint& tap, const float* data, const uint& nsamples);
+
+  /*
+    Single attempt that does not wait. It returns false and leaves output untouched when the values are being
+    published. It is the one the streaming threads use.
+  */
+
+  auto try_snapshot(const uint& tap, LoudnessSnapshot& output) -> bool;
+
+  // retries until it gets a consistent copy. Only for the threads that can wait, like the ui ones
+
+  auto snapshot(const uint& tap) -> LoudnessSnapshot;
+
+  /*
+    The history of the tap is discarded. Snapshots with the returned generation do not have the old frames. That
+    includes the ones still waiting in the ring. Call it from the thread that pushes to the tap.
+  */
+
+  auto reset(const uint& tap) -> uint;
+
+ private:
+  std::string log_tag;
+
+  uint max_history_ms;
+
+  static const uint ring_size = 65536U;  // stereo frames. A power of 2
+
+  struct Tap {
+    uint values = 0U;
+
+    std::vector<float> data = std::vector<float>(2U * ring_size);
+
+    std::atomic<uint> write_pos{0U}, read_pos{0U};  // they only grow and wrap around with the uint
+
+    std::atomic<uint> requested_generation{0U};
+    std::atomic<uint> reset_pos{0U};  // write_pos when the last reset was requested
+
+    std::atomic<uint> dropped{0U};  // frames that did not fit in the ring since the last report
+
+    // published values. seq is odd while the analysis thread writes them
+
+    std::atomic<uint> seq{0U};
+
+    std::atomic<float> momentary{0.0F}, shortterm{0.0F}, global{0.0F}, relative{0.0F}, range{0.0F};
+
+    std::atomic<uint> blocks{0U}, generation{0U};
+
+    std::atomic<bool> valid{false};
+
+    // only used by the analysis thread
+
+    ebur128_state* state = nullptr;
+
+    uint64_t gated_frames = 0U;
+
+    bool dropping = false;  // frames were dropped in the last round
+
+    uint64_t burst_frames = 0U;  // frames dropped since the losses started
+  };
+
+  std::vector<std::unique_ptr<Tap>> taps;
+
+  int rate = 0;                       // used by the streaming thread
+  std::atomic<int> analysis_rate{0};  // rate the analysis thread has to use
+
+  std::thread analyzer;
+  std::mutex analyzer_mutex;
+  std::condition_variable analyzer_cv;
+  bool analyzer_quit = false;
+
+  void analyze();
+
+  void measure(Tap& tap, const int& current_rate, std::vector<float>& buffer);
+
+  static void publish(Tap& tap, const LoudnessSnapshot& s);
+
+  static auto drain(Tap& tap, ebur128_state* state, std::vector<float>& buffer) -> uint;
+
+  auto create_state(const uint& values, const int& rate) const -> ebur128_state*;
+};
+
+#endif
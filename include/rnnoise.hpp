@@ -31,16 +31,10 @@ class RNNoise : public PluginBase {
   auto operator=(const RNNoise&&) -> RNNoise& = delete;
   ~RNNoise() override;
 
-  GstElement *rnnoise = nullptr, *adapter = nullptr, *adapter_out = nullptr;
-
-  void set_caps_out(const uint& sampling_rate);
+  GstElement* rnnoise = nullptr;
 
  private:
-  GstElement *capsfilter_in = nullptr, *capsfilter_out = nullptr;
-
   void bind_to_gsettings();
-
-  void set_caps_in();
 };
 
 #endif
@@ -20,6 +20,7 @@
 #ifndef STREAM_INPUT_EFFECTS_HPP
 #define STREAM_INPUT_EFFECTS_HPP
 
+#include "autogain.hpp"
 #include "multiband_compressor.hpp"
 #include "multiband_gate.hpp"
 #include "pipe_manager.hpp"
@@ -38,11 +39,16 @@ class StreamInputEffects : public PipelineBase {
   std::unique_ptr<Webrtc> webrtc;
   std::unique_ptr<MultibandCompressor> multiband_compressor;
   std::unique_ptr<MultibandGate> multiband_gate;
+  std::unique_ptr<AutoGain> autogain;
 
   void change_input_device(const NodeInfo& node);
 
+  void update_autogain_history_id();
+
   sigc::signal<void, std::array<double, 2>> webrtc_input_level;
   sigc::signal<void, std::array<double, 2>> webrtc_output_level;
+  sigc::signal<void, std::array<double, 2>> autogain_input_level;
+  sigc::signal<void, std::array<double, 2>> autogain_output_level;
 
  private:
   void add_plugins_to_pipeline();
@@ -20,6 +20,7 @@
 #ifndef STREAM_INPUT_EFFECTS_UI_HPP
 #define STREAM_INPUT_EFFECTS_UI_HPP
 
+#include "autogain_ui.hpp"
 #include "compressor_ui.hpp"
 #include "deesser_ui.hpp"
 #include "effects_base_ui.hpp"
@@ -73,6 +74,7 @@ class StreamInputEffectsUi : public Gtk::Box, public EffectsBaseUi {
   StereoToolsUi* stereo_tools_ui = nullptr;
   MaximizerUi* maximizer_ui = nullptr;
   RNNoiseUi* rnnoise_ui = nullptr;
+  AutoGainUi* autogain_ui = nullptr;
 
   void level_meters_connections();
   void up_down_connections();
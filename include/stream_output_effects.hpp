@@ -55,6 +55,8 @@ class StreamOutputEffects : public PipelineBase {
 
   void change_output_device(const NodeInfo& node);
 
+  void update_autogain_history_id();
+
   sigc::signal<void, std::array<double, 2>> bass_enhancer_input_level;
   sigc::signal<void, std::array<double, 2>> bass_enhancer_output_level;
   sigc::signal<void, std::array<double, 2>> exciter_input_level;
@@ -22,8 +22,12 @@
 #include <glibmm/i18n.h>
 #include <gtkmm/dialog.h>
 #include <gtkmm/messagedialog.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
 #include "application_ui.hpp"
 #include "config.h"
+#include "fftw_wisdom.hpp"
 #include "pipe_manager.hpp"
 #include "util.hpp"
 
@@ -48,6 +52,9 @@ Application::Application() : Gtk::Application("com.github.wwmm.pulseeffects", Gi
                         _("Global bypass. 1 to enable, 2 to disable and 3 to get status"));
 
   add_main_option_entry(Gio::Application::OPTION_TYPE_BOOL, "hide-window", 'w', _("Hide the Window."));
+
+  add_main_option_entry(Gio::Application::OPTION_TYPE_BOOL, "generate-wisdom", 'g',
+                        _("Measure the FFT plans used by the convolution based plugins and exit."));
 }
 
 Application::~Application() {
@@ -122,6 +129,8 @@ void Application::on_startup() {
 
   create_actions();
 
+  generate_fftw_wisdom();
+
   pm = std::make_unique<PipeManager>();
   soe = std::make_unique<StreamOutputEffects>(pm.get());
   sie = std::make_unique<StreamInputEffects>(pm.get());
@@ -138,6 +147,8 @@ void Application::on_startup() {
 
       soe->set_output_node_id(node.id);
 
+      soe->update_autogain_history_id();
+
       soe->update_pipeline_state();
 
       sie->webrtc->set_probe_input_node_id(node.id);
@@ -263,6 +274,18 @@ auto Application::on_handle_local_options(const Glib::RefPtr<Glib::VariantDict>&
     return EXIT_SUCCESS;
   }
 
+  if (options->contains("generate-wisdom")) {
+    // the measurement must not slow down the audio
+
+    errno = 0;
+
+    if (nice(19) == -1 && errno != 0) {
+      util::warning(log_tag + "could not lower the priority of the fftw wisdom generator: " + std::strerror(errno));
+    }
+
+    return fftw_wisdom::generate() ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+
   if (options->contains("bypass")) {
     int bypass_arg = 2;
 
@@ -280,6 +303,34 @@ auto Application::on_handle_local_options(const Glib::RefPtr<Glib::VariantDict>&
   return -1;
 }
 
+/*
+  The plans are measured in a child process that lowers its own priority. FFTW planning is not thread safe and the
+  plugins in this process may be creating their plans at the same time. The wisdom is used from the next time the
+  plugins are loaded.
+*/
+
+void Application::generate_fftw_wisdom() {
+  if (fftw_wisdom::wisdom_file_exists()) {
+    return;
+  }
+
+  if (fftw_wisdom::generation_attempted()) {
+    util::debug(log_tag + "the fftw wisdom generation was already tried. Run pulseeffects --generate-wisdom to retry");
+
+    return;
+  }
+
+  util::debug(log_tag + "generating fftw wisdom in the background");
+
+  fftw_wisdom::mark_generation_attempt();
+
+  try {
+    Glib::spawn_async("", std::vector<std::string>{"/proc/self/exe", "--generate-wisdom"});
+  } catch (const Glib::SpawnError& e) {
+    util::warning(log_tag + "could not launch the fftw wisdom generator: " + e.what());
+  }
+}
+
 void Application::create_actions() {
   add_action("about", [&]() {
     auto builder = Gtk::Builder::create_from_resource("/com/github/wwmm/pulseeffects/about.glade");
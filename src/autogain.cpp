@@ -140,10 +140,19 @@ AutoGain::~AutoGain() {
   util::debug(log_tag + name + " destroyed");
 }
 
+void AutoGain::set_history_id(const std::string& id) {
+  if (autogain != nullptr) {
+    g_object_set(autogain, "history-id", id.c_str(), nullptr);
+  }
+}
+
 void AutoGain::bind_to_gsettings() {
   g_settings_bind_with_mapping(settings, "target", autogain, "target", G_SETTINGS_BIND_GET, util::double_to_float,
                                nullptr, nullptr, nullptr);
 
+  g_settings_bind_with_mapping(settings, "ceiling", autogain, "ceiling", G_SETTINGS_BIND_GET, util::double_to_float,
+                               nullptr, nullptr, nullptr);
+
   g_settings_bind(settings, "weight-m", autogain, "weight-m", G_SETTINGS_BIND_DEFAULT);
 
   g_settings_bind(settings, "weight-s", autogain, "weight-s", G_SETTINGS_BIND_DEFAULT);
@@ -154,5 +163,7 @@ void AutoGain::bind_to_gsettings() {
 
   g_settings_bind(settings, "use-geometric-mean", autogain, "use-geometric-mean", G_SETTINGS_BIND_DEFAULT);
 
+  g_settings_bind(settings, "use-limiter", autogain, "use-limiter", G_SETTINGS_BIND_DEFAULT);
+
   g_settings_bind(settings, "reset", autogain, "reset", G_SETTINGS_BIND_DEFAULT);
 }
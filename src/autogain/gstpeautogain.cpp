@@ -34,14 +34,38 @@
 #include "gstpeautogain.hpp"
 #include <gst/audio/gstaudiofilter.h>
 #include <gst/gst.h>
+#include <algorithm>
 #include <cmath>
 #include <iostream>
+#include <map>
+#include <string>
 #include "config.h"
 #include "util.hpp"
 
 GST_DEBUG_CATEGORY_STATIC(gst_peautogain_debug_category);
 #define GST_CAT_DEFAULT gst_peautogain_debug_category
 
+namespace {
+
+/*
+  Compact loudness history of each device or application. It lives as long as the plugin library so it survives
+  the pipeline going to the null state and the element being rebuilt.
+*/
+
+struct PeautogainHistory {
+  float global;  // integrated loudness
+  uint blocks;   // weight of the integrated value in 100 ms blocks
+  float gain;    // last correction gain
+};
+
+const uint max_history_blocks = 36000U;  // one hour. Older loudness fades out
+
+std::mutex history_mutex;
+
+std::map<std::string, PeautogainHistory> history;
+
+}  // namespace
+
 /* prototypes */
 
 static void gst_peautogain_set_property(GObject* object, guint property_id, const GValue* value, GParamSpec* pspec);
@@ -54,10 +78,24 @@ static auto gst_peautogain_transform_ip(GstBaseTransform* trans, GstBuffer* buff
 
 static void gst_peautogain_finalize(GObject* object);
 
-static void gst_peautogain_setup_ebur(GstPeautogain* peautogain);
+static void gst_peautogain_setup_analyzer(GstPeautogain* peautogain);
 
 static void gst_peautogain_reset(GstPeautogain* peautogain);
 
+static void gst_peautogain_update_gain(GstPeautogain* peautogain);
+
+static auto gst_peautogain_stop(GstBaseTransform* base) -> gboolean;
+
+static auto gst_peautogain_query(GstBaseTransform* trans, GstPadDirection direction, GstQuery* query) -> gboolean;
+
+static void gst_peautogain_set_history_id(GstPeautogain* peautogain, gchar* value);
+
+static void gst_peautogain_save_history(GstPeautogain* peautogain);
+
+static void gst_peautogain_load_history(GstPeautogain* peautogain);
+
+static void gst_peautogain_forget_history(GstPeautogain* peautogain);
+
 static void gst_peautogain_process(GstPeautogain* peautogain, GstBuffer* buffer);
 
 enum {
@@ -75,7 +113,10 @@ enum {
   PROP_NOTIFY,
   PROP_DETECT_SILENCE,
   PROP_RESET,
-  PROP_USE_GEOMETRIC_MEAN
+  PROP_USE_GEOMETRIC_MEAN,
+  PROP_HISTORY_ID,
+  PROP_CEILING,
+  PROP_USE_LIMITER
 };
 
 /* pad templates */
@@ -126,6 +167,8 @@ static void gst_peautogain_class_init(GstPeautogainClass* klass) {
 
   audio_filter_class->setup = GST_DEBUG_FUNCPTR(gst_peautogain_setup);
   base_transform_class->transform_ip = GST_DEBUG_FUNCPTR(gst_peautogain_transform_ip);
+  base_transform_class->stop = GST_DEBUG_FUNCPTR(gst_peautogain_stop);
+  base_transform_class->query = GST_DEBUG_FUNCPTR(gst_peautogain_query);
   base_transform_class->transform_ip_on_passthrough = false;
 
   /* define properties */
@@ -206,6 +249,22 @@ static void gst_peautogain_class_init(GstPeautogainClass* klass) {
       g_param_spec_boolean("use-geometric-mean", "Loudness Geometric Mean",
                            "Estimated loudness is the geometric mean of the momentary, short-term and global values",
                            true, static_cast<GParamFlags>(G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS)));
+
+  g_object_class_install_property(
+      gobject_class, PROP_HISTORY_ID,
+      g_param_spec_string("history-id", "History Id",
+                          "Device or application whose loudness history is restored when the element starts", nullptr,
+                          static_cast<GParamFlags>(G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS)));
+
+  g_object_class_install_property(
+      gobject_class, PROP_CEILING,
+      g_param_spec_float("ceiling", "Ceiling", "True peak level the output does not exceed (in dBTP)", -12.0F, 0.0F,
+                         -1.0F, static_cast<GParamFlags>(G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS)));
+
+  g_object_class_install_property(
+      gobject_class, PROP_USE_LIMITER,
+      g_param_spec_boolean("use-limiter", "Use Limiter", "Keep the output true peak below the ceiling", false,
+                           static_cast<GParamFlags>(G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS)));
 }
 
 static void gst_peautogain_init(GstPeautogain* peautogain) {
@@ -223,13 +282,32 @@ static void gst_peautogain_init(GstPeautogain* peautogain) {
   peautogain->loudness = 0.0F;
   peautogain->gain = 1.0F;
   peautogain->range = 0.0F;
-  peautogain->notify_samples = 0U;
+  peautogain->ceiling = -1.0F;
+  peautogain->update_samples = 0U;
   peautogain->sample_count = 0U;
+  peautogain->current_gain = 1.0F;
+  peautogain->gain_step = 0.0F;
+  peautogain->ramp_samples = 0U;
+  peautogain->peak = 0.0F;
+  peautogain->history_id = nullptr;
+  peautogain->history_global = 0.0F;
+  peautogain->history_blocks = 0U;
+  peautogain->live_blocks = 0U;
   peautogain->notify = true;
   peautogain->detect_silence = true;
   peautogain->reset = false;
   peautogain->use_geometric_mean = true;
-  peautogain->ebur_state = nullptr;
+  peautogain->use_limiter = false;
+  peautogain->analyzer = new LoudnessAnalyzer(
+      "peautogain: ", {LoudnessAnalyzer::momentary | LoudnessAnalyzer::shortterm | LoudnessAnalyzer::integrated |
+                       LoudnessAnalyzer::range});
+  peautogain->generation = 0U;
+
+  peautogain->limiter = new TruePeakLimiter("peautogain: ");
+
+  peautogain->limiter->set_ceiling(peautogain->ceiling);
+
+  peautogain->limiter_active = false;
 
   gst_base_transform_set_in_place(GST_BASE_TRANSFORM(peautogain), true);
 }
@@ -264,6 +342,17 @@ void gst_peautogain_set_property(GObject* object, guint property_id, const GValu
     case PROP_USE_GEOMETRIC_MEAN:
       peautogain->use_geometric_mean = g_value_get_boolean(value);
       break;
+    case PROP_HISTORY_ID:
+      gst_peautogain_set_history_id(peautogain, g_value_dup_string(value));
+      break;
+    case PROP_CEILING:
+      peautogain->ceiling = g_value_get_float(value);
+
+      peautogain->limiter->set_ceiling(peautogain->ceiling);
+      break;
+    case PROP_USE_LIMITER:
+      peautogain->use_limiter = g_value_get_boolean(value);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID(object, property_id, pspec);
       break;
@@ -321,6 +410,15 @@ void gst_peautogain_get_property(GObject* object, guint property_id, GValue* val
     case PROP_USE_GEOMETRIC_MEAN:
       g_value_set_boolean(value, peautogain->use_geometric_mean);
       break;
+    case PROP_HISTORY_ID:
+      g_value_set_string(value, peautogain->history_id);
+      break;
+    case PROP_CEILING:
+      g_value_set_float(value, peautogain->ceiling);
+      break;
+    case PROP_USE_LIMITER:
+      g_value_set_boolean(value, peautogain->use_limiter);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID(object, property_id, pspec);
       break;
@@ -336,9 +434,15 @@ static auto gst_peautogain_setup(GstAudioFilter* filter, const GstAudioInfo* inf
 
   peautogain->bpf = info->bpf;
   peautogain->rate = info->rate;
-  peautogain->notify_samples = GST_CLOCK_TIME_TO_FRAMES(GST_SECOND / 10, info->rate);  // notify every 0.1 seconds
+  peautogain->update_samples = GST_CLOCK_TIME_TO_FRAMES(GST_SECOND / 10, info->rate);  // query every 0.1 seconds
+
+  peautogain->analyzer->set_rate(info->rate);
 
-  gst_peautogain_setup_ebur(peautogain);
+  gst_peautogain_setup_analyzer(peautogain);
+
+  peautogain->limiter->create(info->rate);
+
+  peautogain->limiter_active = peautogain->use_limiter;
 
   return true;
 }
@@ -351,13 +455,15 @@ static auto gst_peautogain_transform_ip(GstBaseTransform* trans, GstBuffer* buff
   std::lock_guard<std::mutex> lock(peautogain->lock_guard_ebu);
 
   if (peautogain->reset) {
+    gst_peautogain_forget_history(peautogain);
+
     gst_peautogain_reset(peautogain);
   }
 
   if (peautogain->ready) {
     gst_peautogain_process(peautogain, buffer);
   } else {
-    gst_peautogain_setup_ebur(peautogain);
+    gst_peautogain_setup_analyzer(peautogain);
   }
 
   return GST_FLOW_OK;
@@ -372,141 +478,301 @@ void gst_peautogain_finalize(GObject* object) {
 
   gst_peautogain_reset(peautogain);
 
+  g_free(peautogain->history_id);
+
+  peautogain->history_id = nullptr;
+
+  delete peautogain->limiter;
+  delete peautogain->analyzer;
+
+  peautogain->limiter = nullptr;
+  peautogain->analyzer = nullptr;
+
   G_OBJECT_CLASS(gst_peautogain_parent_class)->finalize(object);
 }
 
-static void gst_peautogain_setup_ebur(GstPeautogain* peautogain) {
-  if (!peautogain->ready) {
-    peautogain->ebur_state = ebur128_init(
-        2U, peautogain->rate,
-        EBUR128_MODE_S | EBUR128_MODE_I | EBUR128_MODE_LRA | EBUR128_MODE_SAMPLE_PEAK | EBUR128_MODE_HISTOGRAM);
+static auto gst_peautogain_stop(GstBaseTransform* base) -> gboolean {
+  GstPeautogain* peautogain = GST_PEAUTOGAIN(base);
 
-    ebur128_set_channel(peautogain->ebur_state, 0U, EBUR128_LEFT);
-    ebur128_set_channel(peautogain->ebur_state, 1U, EBUR128_RIGHT);
+  std::lock_guard<std::mutex> lock(peautogain->lock_guard_ebu);
 
-    peautogain->ready = true;
+  gst_peautogain_save_history(peautogain);
+
+  gst_peautogain_reset(peautogain);
+
+  return 1;
+}
+
+static auto gst_peautogain_query(GstBaseTransform* trans, GstPadDirection direction, GstQuery* query) -> gboolean {
+  GstPeautogain* peautogain = GST_PEAUTOGAIN(trans);
+
+  if (direction == GST_PAD_SRC && GST_QUERY_TYPE(query) == GST_QUERY_LATENCY) {
+    gboolean ret = gst_pad_peer_query(GST_BASE_TRANSFORM_SINK_PAD(trans), query);
+
+    if (ret && peautogain->rate > 0 && peautogain->limiter_active) {
+      gboolean live;
+      GstClockTime min, max;
+
+      gst_query_parse_latency(query, &live, &min, &max);
+
+      /* add the lookahead of the limiter */
+
+      GstClockTime latency = gst_util_uint64_scale_round(peautogain->limiter->latency, GST_SECOND, peautogain->rate);
+
+      min += latency;
+
+      if (max != GST_CLOCK_TIME_NONE) {
+        max += latency;
+      }
+
+      gst_query_set_latency(query, live, min, max);
+    }
+
+    return ret;
   }
+
+  return GST_BASE_TRANSFORM_CLASS(gst_peautogain_parent_class)->query(trans, direction, query);
 }
 
-static void gst_peautogain_reset(GstPeautogain* peautogain) {
-  peautogain->ready = false;
-  peautogain->reset = false;
-  peautogain->gain = 1.0F;
+static void gst_peautogain_set_history_id(GstPeautogain* peautogain, gchar* value) {
+  std::lock_guard<std::mutex> lock(peautogain->lock_guard_ebu);
 
-  if (peautogain->ebur_state != nullptr) {
-    ebur128_destroy(&peautogain->ebur_state);
+  if (g_strcmp0(value, peautogain->history_id) == 0) {
+    g_free(value);
 
-    peautogain->ebur_state = nullptr;
+    return;
   }
+
+  // the current state belongs to the old id. The new one is restored when the streaming thread restarts the measurement
+
+  gst_peautogain_save_history(peautogain);
+
+  gst_peautogain_reset(peautogain);
+
+  g_free(peautogain->history_id);
+
+  peautogain->history_id = value;
 }
 
-static void gst_peautogain_process(GstPeautogain* peautogain, GstBuffer* buffer) {
-  GstMapInfo map;
-  double momentary = 0.0;
-  double shortterm = 0.0;
-  double global = 0.0;
-  double relative = 0.0;
-  double range = 0.0;
-  bool failed = false;
+static void gst_peautogain_save_history(GstPeautogain* peautogain) {
+  if (peautogain->history_id == nullptr || !peautogain->ready) {
+    return;
+  }
 
-  gst_buffer_map(buffer, &map, GST_MAP_READWRITE);
+  uint blocks = std::min(peautogain->history_blocks + peautogain->live_blocks, max_history_blocks);
 
-  auto* data = reinterpret_cast<float*>(map.data);
+  if (blocks == 0U || !std::isfinite(peautogain->global)) {
+    return;
+  }
 
-  guint num_samples = map.size / peautogain->bpf;
+  std::lock_guard<std::mutex> lock(history_mutex);
 
-  ebur128_add_frames_float(peautogain->ebur_state, data, num_samples);
+  history[peautogain->history_id] = PeautogainHistory{peautogain->global, blocks, peautogain->gain};
 
-  if (EBUR128_SUCCESS != ebur128_loudness_momentary(peautogain->ebur_state, &momentary)) {
-    failed = true;
-  } else {
-    peautogain->momentary = static_cast<float>(momentary);
+  util::debug(std::string("peautogain: saved the loudness history of ") + peautogain->history_id);
+}
+
+static void gst_peautogain_load_history(GstPeautogain* peautogain) {
+  peautogain->history_blocks = 0U;
+
+  if (peautogain->history_id == nullptr) {
+    return;
   }
 
-  if (EBUR128_SUCCESS != ebur128_loudness_shortterm(peautogain->ebur_state, &shortterm)) {
-    failed = true;
-  } else {
-    peautogain->shortterm = static_cast<float>(shortterm);
+  std::lock_guard<std::mutex> lock(history_mutex);
+
+  auto it = history.find(peautogain->history_id);
+
+  if (it != history.end()) {
+    peautogain->history_global = it->second.global;
+    peautogain->history_blocks = it->second.blocks;
+    peautogain->global = it->second.global;
+    peautogain->gain = it->second.gain;
+    peautogain->current_gain = it->second.gain;
+
+    util::debug(std::string("peautogain: restored the loudness history of ") + peautogain->history_id);
   }
+}
 
-  if (EBUR128_SUCCESS != ebur128_loudness_global(peautogain->ebur_state, &global)) {
-    failed = true;
-  } else {
-    peautogain->global = static_cast<float>(global);
+static void gst_peautogain_forget_history(GstPeautogain* peautogain) {
+  if (peautogain->history_id == nullptr) {
+    return;
   }
 
-  if (EBUR128_SUCCESS != ebur128_relative_threshold(peautogain->ebur_state, &relative)) {
-    failed = true;
-  } else {
-    peautogain->relative = static_cast<float>(relative);
+  std::lock_guard<std::mutex> lock(history_mutex);
+
+  history.erase(peautogain->history_id);
+}
+
+static void gst_peautogain_setup_analyzer(GstPeautogain* peautogain) {
+  if (!peautogain->ready) {
+    peautogain->generation = peautogain->analyzer->reset(0U);
+
+    gst_peautogain_load_history(peautogain);
+
+    peautogain->ready = true;
   }
+}
 
-  if (EBUR128_SUCCESS != ebur128_loudness_range(peautogain->ebur_state, &range)) {
-    failed = true;
-  } else {
-    peautogain->range = static_cast<float>(range);
+static void gst_peautogain_reset(GstPeautogain* peautogain) {
+  peautogain->ready = false;
+  peautogain->reset = false;
+  peautogain->gain = 1.0F;
+  peautogain->current_gain = 1.0F;
+  peautogain->gain_step = 0.0F;
+  peautogain->ramp_samples = 0U;
+  peautogain->peak = 0.0F;
+  peautogain->sample_count = 0U;
+  peautogain->history_blocks = 0U;
+  peautogain->live_blocks = 0U;
+}
+
+/*
+  The loudness values only change when a new 100 ms block is complete. So the snapshot published by the analyzer is
+  read once per block instead of once per buffer. The new gain is reached through a linear ramp that lasts until the
+  next query.
+*/
+
+static void gst_peautogain_update_gain(GstPeautogain* peautogain) {
+  LoudnessSnapshot snapshot;
+
+  /*
+    The streaming thread does not wait while the analyzer publishes new values. The previous ones are kept for one
+    more block. The same happens when the analyzer has not measured anything since the last reset.
+  */
+
+  bool failed = !peautogain->analyzer->try_snapshot(0U, snapshot) || !snapshot.valid ||
+                snapshot.generation != peautogain->generation;
+
+  if (!failed) {
+    peautogain->momentary = snapshot.momentary;
+    peautogain->shortterm = snapshot.shortterm;
+    peautogain->global = snapshot.global;
+    peautogain->relative = snapshot.relative;
+    peautogain->range = snapshot.range;
+    peautogain->live_blocks = snapshot.blocks;
+  }
+
+  /*
+    libebur128 can not be fed with a histogram. The integrated loudness of the restored history and the one of the
+    current state are averaged in the energy domain, weighted by the number of blocks behind each one.
+  */
+
+  if (peautogain->history_blocks > 0U && !failed) {
+    float w0 = static_cast<float>(peautogain->history_blocks);
+    float w1 = (std::isfinite(peautogain->global)) ? static_cast<float>(peautogain->live_blocks) : 0.0F;
+
+    float e0 = std::pow(10.0F, peautogain->history_global / 10.0F);
+    float e1 = (w1 > 0.0F) ? std::pow(10.0F, peautogain->global / 10.0F) : 0.0F;
+
+    peautogain->global = 10.0F * std::log10((w0 * e0 + w1 * e1) / (w0 + w1));
   }
 
   bool playing_silence = (peautogain->momentary < peautogain->relative && peautogain->detect_silence) ? true : false;
 
   if (peautogain->relative > -70.0F && !failed && !playing_silence) {
-    double peak_L = 0.0, peak_R = 0.0;
-
-    if (EBUR128_SUCCESS != ebur128_prev_sample_peak(peautogain->ebur_state, 0U, &peak_L)) {
-      failed = true;
+    if (peautogain->use_geometric_mean) {
+      peautogain->loudness = std::cbrt(peautogain->momentary * peautogain->shortterm * peautogain->global);
+    } else {
+      peautogain->loudness =
+          (peautogain->weight_m * peautogain->momentary + peautogain->weight_s * peautogain->shortterm +
+           peautogain->weight_i * peautogain->global) /
+          (peautogain->weight_m + peautogain->weight_s + peautogain->weight_i);
     }
 
-    if (EBUR128_SUCCESS != ebur128_prev_sample_peak(peautogain->ebur_state, 1U, &peak_R)) {
-      failed = true;
-    }
+    float diff = peautogain->target - peautogain->loudness;
+
+    // 10^(diff/20). The way below should be faster than using pow
+    float gain = expf((diff / 20.0F) * logf(10.0F));
 
-    if (!failed) {
-      if (peautogain->use_geometric_mean) {
-        peautogain->loudness = std::cbrt(peautogain->momentary * peautogain->shortterm * peautogain->global);
-      } else {
-        peautogain->loudness =
-            (peautogain->weight_m * peautogain->momentary + peautogain->weight_s * peautogain->shortterm +
-             peautogain->weight_i * peautogain->global) /
-            (peautogain->weight_m + peautogain->weight_s + peautogain->weight_i);
+    float db_peak = util::linear_to_db(peautogain->peak);
+
+    if (db_peak > -99.0F) {
+      if (gain * peautogain->peak < 1.0F) {
+        peautogain->gain = gain;
       }
+    }
+  }
+
+  peautogain->peak = 0.0F;
 
-      float diff = peautogain->target - peautogain->loudness;
+  peautogain->ramp_samples = peautogain->update_samples;
+  peautogain->gain_step = (peautogain->gain - peautogain->current_gain) / static_cast<float>(peautogain->ramp_samples);
 
-      // 10^(diff/20). The way below should be faster than using pow
-      float gain = expf((diff / 20.0F) * logf(10.0F));
+  if (!failed && peautogain->notify) {
+    g_object_notify(G_OBJECT(peautogain), "m");
+    g_object_notify(G_OBJECT(peautogain), "s");
+    g_object_notify(G_OBJECT(peautogain), "i");
+    g_object_notify(G_OBJECT(peautogain), "r");
+    g_object_notify(G_OBJECT(peautogain), "l");
+    g_object_notify(G_OBJECT(peautogain), "lra");
+    g_object_notify(G_OBJECT(peautogain), "g");
+  }
+}
 
-      float peak = (peak_L > peak_R) ? peak_L : peak_R;
+static void gst_peautogain_process(GstPeautogain* peautogain, GstBuffer* buffer) {
+  GstMapInfo map;
 
-      float db_peak = util::linear_to_db(peak);
+  gst_buffer_map(buffer, &map, GST_MAP_READWRITE);
 
-      if (db_peak > -99.0F) {
-        if (gain * peak < 1.0F) {
-          peautogain->gain = gain;
-        }
-      }
+  auto* data = reinterpret_cast<float*>(map.data);
+
+  guint num_samples = map.size / peautogain->bpf;
+
+  peautogain->analyzer->push(0U, data, num_samples);
+
+  /*
+    The limiter is switched here so its state and the latency we report change together. It starts from an empty
+    delay line every time it is enabled.
+  */
+
+  if (peautogain->limiter_active != peautogain->use_limiter) {
+    peautogain->limiter_active = peautogain->use_limiter;
+
+    if (peautogain->limiter_active) {
+      peautogain->limiter->create(peautogain->rate);
     }
+
+    gst_element_post_message(GST_ELEMENT_CAST(peautogain), gst_message_new_latency(GST_OBJECT_CAST(peautogain)));
   }
 
-  for (unsigned int n = 0U; n < 2U * num_samples; n++) {
-    data[n] = data[n] * peautogain->gain;
+  // the peak is measured and the limiter runs in the same pass that applies the gain
+
+  bool use_limiter = peautogain->limiter_active;
+  float peak = peautogain->peak;
+  float g = peautogain->current_gain;
+  float step = peautogain->gain_step;
+  uint ramp = peautogain->ramp_samples;
+
+  for (unsigned int n = 0U; n < num_samples; n++) {
+    peak = std::max(peak, std::max(std::fabs(data[2U * n]), std::fabs(data[2U * n + 1U])));
+
+    if (ramp > 0U) {
+      ramp--;
+
+      g = (ramp == 0U) ? peautogain->gain : g + step;
+    }
+
+    if (use_limiter) {
+      peautogain->limiter->process(data[2U * n], data[2U * n + 1U], g);
+    } else {
+      data[2U * n] *= g;
+      data[2U * n + 1U] *= g;
+    }
   }
 
+  peautogain->peak = peak;
+  peautogain->current_gain = g;
+  peautogain->ramp_samples = ramp;
+
   gst_buffer_unmap(buffer, &map);
 
-  if (!failed && peautogain->notify) {
-    peautogain->sample_count += num_samples;
-
-    if (peautogain->sample_count >= peautogain->notify_samples) {
-      peautogain->sample_count = 0U;
-
-      g_object_notify(G_OBJECT(peautogain), "m");
-      g_object_notify(G_OBJECT(peautogain), "s");
-      g_object_notify(G_OBJECT(peautogain), "i");
-      g_object_notify(G_OBJECT(peautogain), "r");
-      g_object_notify(G_OBJECT(peautogain), "l");
-      g_object_notify(G_OBJECT(peautogain), "lra");
-      g_object_notify(G_OBJECT(peautogain), "g");
-    }
+  peautogain->sample_count += num_samples;
+
+  if (peautogain->sample_count >= peautogain->update_samples) {
+    peautogain->sample_count = 0U;
+
+    gst_peautogain_update_gain(peautogain);
   }
 }
 
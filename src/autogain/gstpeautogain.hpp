@@ -20,9 +20,10 @@
 #ifndef GST_PEAUTOGAIN_H
 #define GST_PEAUTOGAIN_H
 
-#include <ebur128.h>
 #include <gst/audio/gstaudiofilter.h>
 #include <mutex>
+#include "loudness_analyzer.hpp"
+#include "true_peak_limiter.hpp"
 
 G_BEGIN_DECLS
 
@@ -48,7 +49,9 @@ struct GstPeautogain {
   float loudness;   // estimated loudness
   float gain;       // correction gain
   float range;      // loudness range
-  bool detect_silence, reset, use_geometric_mean;
+  float ceiling;    // true peak ceiling of the limiter
+  bool detect_silence, reset, use_geometric_mean, use_limiter;
+  gchar* history_id;  // device or application whose loudness history is kept between restarts
 
   /* < private > */
 
@@ -56,9 +59,23 @@ struct GstPeautogain {
   int bpf;   // bytes per frame : channels * bps
   int rate;  // sampling rate
 
-  uint notify_samples;  // number of samples to count before emit a notify
+  uint update_samples;  // frames between loudness queries. It is the 100 ms hop of the EBU momentary blocks
   uint sample_count;
-  ebur128_state* ebur_state = nullptr;
+
+  float current_gain;  // gain applied to the last frame. It ramps to gain
+  float gain_step;     // increment per frame of the ramp
+  uint ramp_samples;   // frames left in the ramp
+  float peak;          // input sample peak since the last query
+
+  float history_global;  // integrated loudness restored from the history
+  uint history_blocks;   // number of 100 ms blocks behind history_global
+  uint live_blocks;      // blocks above the absolute gate measured since the analyzer was reset
+
+  LoudnessAnalyzer* analyzer;  // measures the input in a background thread
+  uint generation;             // snapshots from before the last reset of the analyzer are ignored
+
+  TruePeakLimiter* limiter;
+  bool limiter_active;  // use_limiter as seen by the streaming thread
 
   std::mutex lock_guard_ebu;
 };
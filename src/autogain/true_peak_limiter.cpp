@@ -0,0 +1,101 @@
+/*
+ *  Copyright © 2017-2020 Wellington Wallace
+ *
+ *  This file is part of PulseEffects.
+ *
+ *  PulseEffects is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  PulseEffects is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with PulseEffects.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "true_peak_limiter.hpp"
+#include <boost/math/constants/constants.hpp>
+#include <algorithm>
+
+namespace {
+
+const float PI = boost::math::constants::pi<float>();
+
+const float lookahead_time = 0.002F;  // seconds
+const float release_time = 0.05F;     // seconds
+
+}  // namespace
+
+TruePeakLimiter::TruePeakLimiter(const std::string& tag) : log_tag(tag) {}
+
+void TruePeakLimiter::create(const int& rate) {
+  ready = false;
+
+  lookahead = std::max(1U, static_cast<uint>(std::lround(lookahead_time * static_cast<float>(rate))));
+  inv_lookahead = 1.0F / static_cast<float>(lookahead);
+  release_coef = 1.0F - std::exp(-1.0F / (release_time * static_cast<float>(rate)));
+
+  /*
+    Windowed sinc interpolator. The phase p estimates the signal p / 4 frames after the sample in the middle of the
+    history window. Each phase is normalized to unity gain at dc.
+  */
+
+  phases.resize((nphases - 1U) * ntaps);
+
+  for (uint p = 1U; p < nphases; p++) {
+    float* h = phases.data() + (p - 1U) * ntaps;
+    float sum = 0.0F;
+
+    for (uint j = 0U; j < ntaps; j++) {
+      float u = static_cast<float>(ntaps / 2U) - static_cast<float>(j) -
+                static_cast<float>(p) / static_cast<float>(nphases);
+
+      float sinc = (std::fabs(u) < 1.0e-6F) ? 1.0F : std::sin(PI * u) / (PI * u);
+      float window = 0.5F * (1.0F + std::cos(PI * u / static_cast<float>(ntaps / 2U)));
+
+      h[j] = sinc * window;
+
+      sum += h[j];
+    }
+
+    for (uint j = 0U; j < ntaps; j++) {
+      h[j] /= sum;
+    }
+  }
+
+  hist_l.assign(2U * ntaps, 0.0F);
+  hist_r.assign(2U * ntaps, 0.0F);
+  hist_pos = 0U;
+
+  min_values.assign(lookahead + 2U, 1.0F);
+  min_frames.assign(lookahead + 2U, 0U);
+  min_front = 0U;
+  min_count = 0U;
+  frame = 0U;
+
+  envelope = 1.0F;
+
+  smooth_ring.assign(lookahead, 1.0F);
+  smooth_pos = 0U;
+  smooth_sum = static_cast<double>(lookahead);
+
+  // the peak found by the interpolator is ntaps / 2 frames old
+
+  latency = lookahead + ntaps / 2U;
+
+  delay_l.assign(latency, 0.0F);
+  delay_r.assign(latency, 0.0F);
+  delay_pos = 0U;
+
+  ready = true;
+
+  util::debug(log_tag + "true peak limiter latency: " + std::to_string(latency) + " samples");
+}
+
+void TruePeakLimiter::set_ceiling(const float& value) {
+  ceiling.store(util::db_to_linear(value));
+}
@@ -0,0 +1,176 @@
+/*
+ *  Copyright © 2017-2020 Wellington Wallace
+ *
+ *  This file is part of PulseEffects.
+ *
+ *  PulseEffects is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  PulseEffects is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with PulseEffects.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef TRUE_PEAK_LIMITER_HPP
+#define TRUE_PEAK_LIMITER_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <string>
+#include <vector>
+#include "util.hpp"
+
+/*
+  Stereo lookahead limiter that works on the true peak. The peak between the samples is estimated with a 4x
+  polyphase interpolator. The gain needed to keep the peaks below the ceiling goes through a sliding minimum and a
+  moving average as long as the lookahead. So the gain is already down when the delayed peak reaches the output.
+
+  It is processed frame by frame so the autogain can apply its own gain and the limiter in the same pass.
+*/
+
+class TruePeakLimiter {
+ public:
+  TruePeakLimiter(const std::string& tag);
+
+  bool ready = false;
+
+  uint latency = 0U;  // in frames
+
+  void create(const int& rate);
+
+  // ceiling in dB true peak. It can be changed while processing
+
+  void set_ceiling(const float& value);
+
+  // applies the input gain to the frame, limits it and returns the frame that left the delay line
+
+  inline void process(float& left, float& right, const float& input_gain) {
+    push_history(left, right);
+
+    float tp = std::max(true_peak(hist_l), true_peak(hist_r)) * input_gain;
+
+    float limit = ceiling.load(std::memory_order_relaxed);
+
+    float required = (tp > limit) ? limit / tp : 1.0F;
+
+    float envelope_target = sliding_min(required);
+
+    envelope = (envelope_target < envelope) ? envelope_target : envelope + (envelope_target - envelope) * release_coef;
+
+    smooth_sum += envelope - smooth_ring[smooth_pos];
+    smooth_ring[smooth_pos] = envelope;
+    smooth_pos = (smooth_pos + 1U == lookahead) ? 0U : smooth_pos + 1U;
+
+    float g = std::min(static_cast<float>(smooth_sum) * inv_lookahead, 1.0F);
+
+    float out_l = delay_l[delay_pos] * g;
+    float out_r = delay_r[delay_pos] * g;
+
+    delay_l[delay_pos] = left * input_gain;
+    delay_r[delay_pos] = right * input_gain;
+    delay_pos = (delay_pos + 1U == latency) ? 0U : delay_pos + 1U;
+
+    left = out_l;
+    right = out_r;
+  }
+
+ private:
+  static constexpr uint ntaps = 12U;   // taps of each interpolator phase
+  static constexpr uint nphases = 4U;  // oversampling factor
+
+  std::string log_tag;
+
+  std::atomic<float> ceiling = {1.0F};  // linear
+
+  uint lookahead = 0U;
+  float inv_lookahead = 0.0F;
+  float release_coef = 0.0F;
+
+  // the last ntaps samples are written twice so the interpolator always reads a contiguous window
+
+  std::vector<float> hist_l, hist_r;
+  uint hist_pos = 0U;
+
+  std::vector<float> phases;  // [phase - 1][tap] coefficients of the fractional phases
+
+  /*
+    Monotonic queue of the sliding minimum. The window has lookahead + 2 frames. The extra frame covers the
+    interpolated peaks that lie between the delayed sample and the next one.
+  */
+
+  std::vector<float> min_values;
+  std::vector<uint> min_frames;
+  uint min_front = 0U, min_count = 0U, frame = 0U;
+
+  float envelope = 1.0F;
+
+  std::vector<float> smooth_ring;
+  uint smooth_pos = 0U;
+  double smooth_sum = 0.0;  // float would drift after some hours
+
+  std::vector<float> delay_l, delay_r;
+  uint delay_pos = 0U;
+
+  inline void push_history(const float& left, const float& right) {
+    hist_pos = (hist_pos == 0U) ? ntaps - 1U : hist_pos - 1U;
+
+    hist_l[hist_pos] = left;
+    hist_l[hist_pos + ntaps] = left;
+    hist_r[hist_pos] = right;
+    hist_r[hist_pos + ntaps] = right;
+  }
+
+  // largest absolute value among the sample in the middle of the window and the 3 points after it
+
+  inline auto true_peak(const std::vector<float>& hist) -> float {
+    const float* x = hist.data() + hist_pos;  // x[j] is the sample j frames ago
+
+    float peak = std::fabs(x[ntaps / 2U]);
+
+    for (uint p = 0U; p < nphases - 1U; p++) {
+      const float* h = phases.data() + p * ntaps;
+
+      float v = 0.0F;
+
+      for (uint j = 0U; j < ntaps; j++) {
+        v += h[j] * x[j];
+      }
+
+      peak = std::max(peak, std::fabs(v));
+    }
+
+    return peak;
+  }
+
+  inline auto sliding_min(const float& value) -> float {
+    uint size = lookahead + 2U;
+
+    while (min_count > 0U && min_values[(min_front + min_count - 1U) % size] >= value) {
+      min_count--;
+    }
+
+    uint back = (min_front + min_count) % size;
+
+    min_values[back] = value;
+    min_frames[back] = frame;
+    min_count++;
+
+    while (frame - min_frames[min_front] >= size) {
+      min_front = (min_front + 1U) % size;
+      min_count--;
+    }
+
+    frame++;
+
+    return min_values[min_front];
+  }
+};
+
+#endif
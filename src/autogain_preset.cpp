@@ -21,7 +21,9 @@
 
 AutoGainPreset::AutoGainPreset()
     : output_settings(Gio::Settings::create("com.github.wwmm.pulseeffects.autogain",
-                                            "/com/github/wwmm/pulseeffects/sinkinputs/autogain/")) {}
+                                            "/com/github/wwmm/pulseeffects/sinkinputs/autogain/")),
+      input_settings(Gio::Settings::create("com.github.wwmm.pulseeffects.autogain",
+                                           "/com/github/wwmm/pulseeffects/sourceoutputs/autogain/")) {}
 
 void AutoGainPreset::save(boost::property_tree::ptree& root,
                           const std::string& section,
@@ -38,6 +40,10 @@ void AutoGainPreset::save(boost::property_tree::ptree& root,
 
   root.put(section + ".autogain.target", settings->get_double("target"));
 
+  root.put(section + ".autogain.use-limiter", settings->get_boolean("use-limiter"));
+
+  root.put(section + ".autogain.ceiling", settings->get_double("ceiling"));
+
   root.put(section + ".autogain.weight-m", settings->get_int("weight-m"));
 
   root.put(section + ".autogain.weight-s", settings->get_int("weight-s"));
@@ -60,6 +66,10 @@ void AutoGainPreset::load(const boost::property_tree::ptree& root,
 
   update_key<double>(root, settings, "target", section + ".autogain.target");
 
+  update_key<bool>(root, settings, "use-limiter", section + ".autogain.use-limiter");
+
+  update_key<double>(root, settings, "ceiling", section + ".autogain.ceiling");
+
   update_key<int>(root, settings, "weight-m", section + ".autogain.weight-m");
 
   update_key<int>(root, settings, "weight-s", section + ".autogain.weight-s");
@@ -68,13 +78,23 @@ void AutoGainPreset::load(const boost::property_tree::ptree& root,
 }
 
 void AutoGainPreset::write(PresetType preset_type, boost::property_tree::ptree& root) {
-  if (preset_type == PresetType::output) {
-    save(root, "output", output_settings);
+  switch (preset_type) {
+    case PresetType::output:
+      save(root, "output", output_settings);
+      break;
+    case PresetType::input:
+      save(root, "input", input_settings);
+      break;
   }
 }
 
 void AutoGainPreset::read(PresetType preset_type, const boost::property_tree::ptree& root) {
-  if (preset_type == PresetType::output) {
-    load(root, "output", output_settings);
+  switch (preset_type) {
+    case PresetType::output:
+      load(root, "output", output_settings);
+      break;
+    case PresetType::input:
+      load(root, "input", input_settings);
+      break;
   }
 }
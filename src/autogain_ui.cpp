@@ -47,9 +47,11 @@ AutoGainUi::AutoGainUi(BaseObjectType* cobject,
   builder->get_widget("reset", reset_history);
   builder->get_widget("detect_silence", detect_silence);
   builder->get_widget("use_geometric_mean", use_geometric_mean);
+  builder->get_widget("use_limiter", use_limiter);
   builder->get_widget("weight_m_grid", weight_m_grid);
   builder->get_widget("weight_s_grid", weight_s_grid);
   builder->get_widget("weight_i_grid", weight_i_grid);
+  builder->get_widget("ceiling_grid", ceiling_grid);
 
   builder->get_widget("plugin_reset", reset_button);
 
@@ -57,6 +59,7 @@ AutoGainUi::AutoGainUi(BaseObjectType* cobject,
   builder->get_widget("l_label", l_label);
   get_object(builder, "output_gain", output_gain);
   get_object(builder, "target", target);
+  get_object(builder, "ceiling", ceiling);
   get_object(builder, "weight_m", weight_m);
   get_object(builder, "weight_s", weight_s);
   get_object(builder, "weight_i", weight_i);
@@ -69,6 +72,7 @@ AutoGainUi::AutoGainUi(BaseObjectType* cobject,
   settings->bind("input-gain", input_gain.get(), "value", flag);
   settings->bind("output-gain", output_gain.get(), "value", flag);
   settings->bind("target", target.get(), "value", flag);
+  settings->bind("ceiling", ceiling.get(), "value", flag);
   settings->bind("weight-m", weight_m.get(), "value", flag);
   settings->bind("weight-s", weight_s.get(), "value", flag);
   settings->bind("weight-i", weight_i.get(), "value", flag);
@@ -76,6 +80,8 @@ AutoGainUi::AutoGainUi(BaseObjectType* cobject,
   settings->bind("use-geometric-mean", use_geometric_mean, "active", flag);
   settings->bind("use-geometric-mean", weight_m_grid, "sensitive",
                  Gio::SettingsBindFlags::SETTINGS_BIND_GET | Gio::SettingsBindFlags::SETTINGS_BIND_INVERT_BOOLEAN);
+  settings->bind("use-limiter", use_limiter, "active", flag);
+  settings->bind("use-limiter", ceiling_grid, "sensitive", Gio::SettingsBindFlags::SETTINGS_BIND_GET);
   settings->bind("use-geometric-mean", weight_s_grid, "sensitive",
                  Gio::SettingsBindFlags::SETTINGS_BIND_GET | Gio::SettingsBindFlags::SETTINGS_BIND_INVERT_BOOLEAN);
   settings->bind("use-geometric-mean", weight_i_grid, "sensitive",
@@ -96,12 +102,16 @@ void AutoGainUi::reset() {
 
   settings->reset("use-geometric-mean");
 
+  settings->reset("use-limiter");
+
   settings->reset("input-gain");
 
   settings->reset("output-gain");
 
   settings->reset("target");
 
+  settings->reset("ceiling");
+
   settings->reset("weight-m");
 
   settings->reset("weight-s");
@@ -21,20 +21,6 @@
 #include <glibmm/main.h>
 #include "util.hpp"
 
-namespace {
-
-void on_n_input_samples_changed(GObject* gobject, GParamSpec* pspec, Convolver* c) {
-  int v = 0;
-  int blocksize = 0;
-
-  g_object_get(c->adapter, "n-input-samples", &v, nullptr);
-  g_object_get(c->adapter, "blocksize", &blocksize, nullptr);
-
-  util::debug(c->log_tag + "convolver: new input block size " + std::to_string(v) + " frames");
-}
-
-}  // namespace
-
 Convolver::Convolver(const std::string& tag, const std::string& schema, const std::string& schema_path)
     : PluginBase(tag, "convolver", schema, schema_path) {
   convolver = gst_element_factory_make("peconvolver", "convolver");
@@ -46,13 +32,12 @@ Convolver::Convolver(const std::string& tag, const std::string& schema, const st
     auto* output_gain = gst_element_factory_make("volume", nullptr);
     auto* audioconvert_in = gst_element_factory_make("audioconvert", "convolver_audioconvert_in");
     auto* audioconvert_out = gst_element_factory_make("audioconvert", "convolver_audioconvert_out");
-    adapter = gst_element_factory_make("peadapter", nullptr);
 
-    gst_bin_add_many(GST_BIN(bin), input_gain, in_level, adapter, audioconvert_in, convolver, audioconvert_out,
-                     output_gain, out_level, nullptr);
+    gst_bin_add_many(GST_BIN(bin), input_gain, in_level, audioconvert_in, convolver, audioconvert_out, output_gain,
+                     out_level, nullptr);
 
-    gst_element_link_many(input_gain, in_level, adapter, audioconvert_in, convolver, audioconvert_out, output_gain,
-                          out_level, nullptr);
+    gst_element_link_many(input_gain, in_level, audioconvert_in, convolver, audioconvert_out, output_gain, out_level,
+                          nullptr);
 
     auto* pad_sink = gst_element_get_static_pad(input_gain, "sink");
     auto* pad_src = gst_element_get_static_pad(out_level, "src");
@@ -63,11 +48,6 @@ Convolver::Convolver(const std::string& tag, const std::string& schema, const st
     gst_object_unref(GST_OBJECT(pad_sink));
     gst_object_unref(GST_OBJECT(pad_src));
 
-    g_object_set(adapter, "blocksize", 512, nullptr);
-    g_object_set(adapter, "passthrough", 1, nullptr);
-
-    g_signal_connect(adapter, "notify::n-input-samples", G_CALLBACK(on_n_input_samples_changed), this);
-
     bind_to_gsettings();
 
     g_settings_bind(settings, "post-messages", in_level, "post-messages", G_SETTINGS_BIND_DEFAULT);
@@ -95,4 +75,9 @@ void Convolver::bind_to_gsettings() {
   g_settings_bind(settings, "kernel-path", convolver, "kernel-path", G_SETTINGS_BIND_DEFAULT);
 
   g_settings_bind(settings, "ir-width", convolver, "ir-width", G_SETTINGS_BIND_DEFAULT);
+
+  g_settings_bind(settings, "partitioning", convolver, "partitioning", G_SETTINGS_BIND_DEFAULT);
+
+  g_settings_bind_with_mapping(settings, "tail-threshold", convolver, "tail-threshold", G_SETTINGS_BIND_GET,
+                               util::double_to_float, nullptr, nullptr, nullptr);
 }
@@ -34,7 +34,12 @@
 #include "gstpeconvolver.hpp"
 #include <gst/audio/gstaudiofilter.h>
 #include <gst/gst.h>
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <thread>
 #include "config.h"
+#include "fftw_wisdom.hpp"
 #include "read_kernel.hpp"
 
 GST_DEBUG_CATEGORY_STATIC(gst_peconvolver_debug_category);
@@ -58,9 +63,28 @@ static void gst_peconvolver_set_kernel_path(GstPeconvolver* peconvolver, gchar*
 
 static void gst_peconvolver_set_ir_width(GstPeconvolver* peconvolver, const uint& value);
 
-static void gst_peconvolver_process(GstPeconvolver* peconvolver, GstBuffer* buffer);
+static void gst_peconvolver_set_tail_threshold(GstPeconvolver* peconvolver, const float& value);
 
-static void gst_peconvolver_setup_convolver(GstPeconvolver* peconvolver);
+static void gst_peconvolver_set_blocksize(GstPeconvolver* peconvolver, const uint& value);
+
+static gboolean gst_peconvolver_query(GstBaseTransform* trans, GstPadDirection direction, GstQuery* query);
+
+static void gst_peconvolver_process(GstPeconvolver* peconvolver);
+
+static void gst_peconvolver_load_kernel(GstPeconvolver* peconvolver);
+
+static void gst_peconvolver_loader(GstPeconvolver* peconvolver);
+
+static void gst_peconvolver_setup_convolver(GstPeconvolver* peconvolver,
+                                            const uint& id,
+                                            const int& rate,
+                                            const uint& blocksize);
+
+static void gst_peconvolver_destroy_engine(PeconvolverEngine* engine);
+
+static void gst_peconvolver_free_retired_engine(GstPeconvolver* peconvolver);
+
+static void gst_peconvolver_retire_engine(GstPeconvolver* peconvolver, PeconvolverEngine* engine);
 
 static void gst_peconvolver_finish_convolver(GstPeconvolver* peconvolver);
 
@@ -79,7 +103,53 @@ static void gst_peconvolver_finish_convolver(GstPeconvolver* peconvolver);
 #define CONVPROC_SCHEDULER_CLASS SCHED_FIFO
 #define THREAD_SYNC_MODE true
 
-enum { PROP_KERNEL_PATH = 1, PROP_IR_WIDTH };
+enum { PROP_KERNEL_PATH = 1, PROP_IR_WIDTH, PROP_PARTITIONING, PROP_TAIL_THRESHOLD };
+
+#define GST_TYPE_PECONVOLVER_PARTITIONING (gst_peconvolver_partitioning_get_type())
+
+static GType gst_peconvolver_partitioning_get_type() {
+  static GType type = 0;
+
+  static const GEnumValue values[] = {
+      {PECONVOLVER_PARTITIONING_MIN_LATENCY, "Minimum latency", "min-latency"},
+      {PECONVOLVER_PARTITIONING_BALANCED, "Balanced", "balanced"},
+      {PECONVOLVER_PARTITIONING_MIN_CPU, "Minimum CPU usage", "min-cpu"},
+      {0, nullptr, nullptr}};
+
+  if (type == 0) {
+    type = g_enum_register_static("GstPeconvolverPartitioning", values);
+  }
+
+  return type;
+}
+
+/*
+  Block size in frames used by each partitioning mode. In min-latency the first partition follows the quantum of the
+  buffers we receive. It is the largest power of 2 not larger than the quantum within the partition sizes zita
+  accepts. So the fifo delays the audio by at most one buffer. 128 frames are used until the quantum is known.
+*/
+
+static uint gst_peconvolver_get_partition_size(const int& partitioning, const uint& quantum) {
+  switch (partitioning) {
+    case PECONVOLVER_PARTITIONING_MIN_LATENCY: {
+      if (quantum == 0U) {
+        return 128U;
+      }
+
+      uint size = Convproc::MINPART;
+
+      while (2U * size <= quantum && 2U * size <= Convproc::MAXQUANT) {
+        size *= 2U;
+      }
+
+      return size;
+    }
+    case PECONVOLVER_PARTITIONING_MIN_CPU:
+      return 2048U;
+    default:
+      return 512U;
+  }
+}
 
 /* pad templates */
 
@@ -123,6 +193,10 @@ static void gst_peconvolver_class_init(GstPeconvolverClass* klass) {
   gst_element_class_set_static_metadata(GST_ELEMENT_CLASS(klass), "PulseEffects Convolver", "Generic",
                                         "PulseEffects Convolver", "Wellington <wellingtonwallace@gmail.com>");
 
+  // zita plans its ffts when the engines are configured. Measured plans have to be known before that
+
+  fftw_wisdom::load();
+
   /* define virtual function pointers */
 
   gobject_class->set_property = gst_peconvolver_set_property;
@@ -138,6 +212,8 @@ static void gst_peconvolver_class_init(GstPeconvolverClass* klass) {
 
   base_transform_class->stop = GST_DEBUG_FUNCPTR(gst_peconvolver_stop);
 
+  base_transform_class->query = GST_DEBUG_FUNCPTR(gst_peconvolver_query);
+
   /* define properties */
 
   g_object_class_install_property(
@@ -149,17 +225,41 @@ static void gst_peconvolver_class_init(GstPeconvolverClass* klass) {
       gobject_class, PROP_IR_WIDTH,
       g_param_spec_int("ir-width", "IR Width", "Impulse Response Stereo Width", 0, 200, 100,
                        static_cast<GParamFlags>(G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS)));
+
+  g_object_class_install_property(
+      gobject_class, PROP_PARTITIONING,
+      g_param_spec_enum("partitioning", "Partitioning", "Trade between latency and CPU usage",
+                        GST_TYPE_PECONVOLVER_PARTITIONING, PECONVOLVER_PARTITIONING_BALANCED,
+                        static_cast<GParamFlags>(G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS)));
+
+  g_object_class_install_property(
+      gobject_class, PROP_TAIL_THRESHOLD,
+      g_param_spec_float("tail-threshold", "Tail Threshold",
+                         "The kernel is cut where its energy decay curve falls below this level (dB)", -200.0F, -30.0F,
+                         -100.0F, static_cast<GParamFlags>(G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS)));
 }
 
 static void gst_peconvolver_init(GstPeconvolver* peconvolver) {
   peconvolver->log_tag = "convolver: ";
-  peconvolver->ready = false;
-  peconvolver->irs_fail_count = 0;
   peconvolver->rate = 0;
   peconvolver->bpf = 0;
   peconvolver->kernel_path = nullptr;
   peconvolver->ir_width = 100U;
-  peconvolver->num_samples = 0U;
+  peconvolver->tail_threshold = -100.0F;
+  peconvolver->partitioning = PECONVOLVER_PARTITIONING_BALANCED;
+  peconvolver->blocksize = gst_peconvolver_get_partition_size(PECONVOLVER_PARTITIONING_BALANCED, 0U);
+  peconvolver->quantum = 0U;
+  peconvolver->buffer_frames = 0U;
+  peconvolver->fifo_pos = 0U;
+  peconvolver->ms_coeff = 0.0F;
+  peconvolver->engine = nullptr;
+  peconvolver->next_engine = nullptr;
+  peconvolver->retired_engine = nullptr;
+  peconvolver->load_pending = true;
+  peconvolver->load_id = 0U;
+  peconvolver->load_requested = false;
+  peconvolver->loader_busy = false;
+  peconvolver->loader_quit = false;
 
   gst_base_transform_set_in_place(GST_BASE_TRANSFORM(peconvolver), true);
 }
@@ -176,6 +276,13 @@ void gst_peconvolver_set_property(GObject* object, guint property_id, const GVal
     case PROP_IR_WIDTH:
       gst_peconvolver_set_ir_width(peconvolver, g_value_get_int(value));
       break;
+    case PROP_PARTITIONING:
+      // the streaming thread changes the block size when it sees the new value
+      peconvolver->partitioning = g_value_get_enum(value);
+      break;
+    case PROP_TAIL_THRESHOLD:
+      gst_peconvolver_set_tail_threshold(peconvolver, g_value_get_float(value));
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID(object, property_id, pspec);
       break;
@@ -194,6 +301,12 @@ void gst_peconvolver_get_property(GObject* object, guint property_id, GValue* va
     case PROP_IR_WIDTH:
       g_value_set_int(value, peconvolver->ir_width);
       break;
+    case PROP_PARTITIONING:
+      g_value_set_enum(value, peconvolver->partitioning);
+      break;
+    case PROP_TAIL_THRESHOLD:
+      g_value_set_float(value, peconvolver->tail_threshold);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID(object, property_id, pspec);
       break;
@@ -205,10 +318,24 @@ void gst_peconvolver_finalize(GObject* object) {
 
   GST_DEBUG_OBJECT(peconvolver, "finalize");
 
-  std::lock_guard<std::mutex> lock(peconvolver->lock_guard_zita);
-
   gst_peconvolver_finish_convolver(peconvolver);
 
+  if (peconvolver->loader.joinable()) {
+    {
+      std::lock_guard<std::mutex> lock(peconvolver->loader_mutex);
+
+      peconvolver->loader_quit = true;
+    }
+
+    peconvolver->loader_cv.notify_all();
+
+    peconvolver->loader.join();
+  }
+
+  g_free(peconvolver->kernel_path);
+
+  peconvolver->kernel_path = nullptr;
+
   /* clean up object here */
 
   G_OBJECT_CLASS(gst_peconvolver_parent_class)->finalize(object);
@@ -224,13 +351,14 @@ static gboolean gst_peconvolver_setup(GstAudioFilter* filter, const GstAudioInfo
 
   /*
   this function is called whenever there is a format change. So we reset the
-  zita convolver. Setup will reinitialize zita when necessary.
+  zita convolver. The next buffer will trigger a new engine.
   */
 
-  std::lock_guard<std::mutex> lock(peconvolver->lock_guard_zita);
-
   gst_peconvolver_finish_convolver(peconvolver);
 
+  gst_peconvolver_set_blocksize(peconvolver,
+                                gst_peconvolver_get_partition_size(peconvolver->partitioning, peconvolver->quantum));
+
   return true;
 }
 
@@ -239,43 +367,70 @@ static GstFlowReturn gst_peconvolver_transform_ip(GstBaseTransform* trans, GstBu
 
   GST_DEBUG_OBJECT(peconvolver, "transform");
 
-  std::lock_guard<std::mutex> lock(peconvolver->lock_guard_zita);
-
   GstMapInfo map;
 
-  gst_buffer_map(buffer, &map, GST_MAP_READ);
+  gst_buffer_map(buffer, &map, GST_MAP_READWRITE);
+
+  auto* data = reinterpret_cast<float*>(map.data);
 
   guint num_samples = map.size / peconvolver->bpf;
 
-  gst_buffer_unmap(buffer, &map);
+  /*
+    A single buffer of another size, like the last one before a pause, does not change the quantum. Otherwise the
+    min-latency mode would build a new engine for it.
+  */
 
-  if (peconvolver->ready) {
-    if (peconvolver->num_samples == num_samples) {
-      gst_peconvolver_process(peconvolver, buffer);
-    } else {
-      gst_peconvolver_finish_convolver(peconvolver);
-    }
-  } else if (peconvolver->irs_fail_count == 0) {
-    peconvolver->num_samples = num_samples;
+  if (num_samples == peconvolver->buffer_frames) {
+    peconvolver->quantum = num_samples;
+  }
+
+  peconvolver->buffer_frames = num_samples;
+
+  uint blocksize = gst_peconvolver_get_partition_size(peconvolver->partitioning, peconvolver->quantum);
+
+  if (blocksize != peconvolver->blocksize) {
+    // the current engine can not be used anymore. Audio is delayed without processing until the new one is ready
+
+    gst_peconvolver_set_blocksize(peconvolver, blocksize);
+  }
+
+  if (peconvolver->load_pending.exchange(false)) {
+    gst_peconvolver_load_kernel(peconvolver);
+  }
 
-    auto f = [=]() {
-      std::lock_guard<std::mutex> lock(peconvolver->lock_guard_zita);
-      gst_peconvolver_setup_convolver(peconvolver);
-    };
+  /*
+    zita always works with blocks of blocksize frames. The input buffer goes to a fifo and is replaced by what is in
+    the output fifo. Whenever the input fifo is full a block is convolved. This adds a constant latency of blocksize
+    frames whatever the size of the buffers we receive.
+  */
+
+  for (guint n = 0U; n < num_samples;) {
+    guint count = std::min(num_samples - n, peconvolver->blocksize - peconvolver->fifo_pos);
+
+    auto* fifo_in = peconvolver->fifo_in.data() + 2U * peconvolver->fifo_pos;
+    auto* fifo_out = peconvolver->fifo_out.data() + 2U * peconvolver->fifo_pos;
 
-    auto future = std::async(std::launch::async, f);
+    std::memcpy(fifo_in, data + 2U * n, 2U * count * sizeof(float));
+    std::memcpy(data + 2U * n, fifo_out, 2U * count * sizeof(float));
 
-    peconvolver->futures.emplace_back(std::move(future));
+    n += count;
+    peconvolver->fifo_pos += count;
+
+    if (peconvolver->fifo_pos == peconvolver->blocksize) {
+      gst_peconvolver_process(peconvolver);
+
+      peconvolver->fifo_pos = 0U;
+    }
   }
 
+  gst_buffer_unmap(buffer, &map);
+
   return GST_FLOW_OK;
 }
 
 static gboolean gst_peconvolver_stop(GstBaseTransform* base) {
   GstPeconvolver* peconvolver = GST_PECONVOLVER(base);
 
-  std::lock_guard<std::mutex> lock(peconvolver->lock_guard_zita);
-
   gst_peconvolver_finish_convolver(peconvolver);
 
   return true;
@@ -283,20 +438,18 @@ static gboolean gst_peconvolver_stop(GstBaseTransform* base) {
 
 static void gst_peconvolver_set_kernel_path(GstPeconvolver* peconvolver, gchar* value) {
   if (value != nullptr) {
-    if (peconvolver->kernel_path != nullptr) {
-      std::lock_guard<std::mutex> lock(peconvolver->lock_guard_zita);
+    std::lock_guard<std::mutex> lock(peconvolver->lock_guard_params);
 
+    if (peconvolver->kernel_path != nullptr) {
       std::string old_path = peconvolver->kernel_path;
 
       g_free(peconvolver->kernel_path);
 
       peconvolver->kernel_path = value;
 
-      if (peconvolver->kernel_path != nullptr) {
-        if (old_path != peconvolver->kernel_path) {
-          // resetting zita
-          gst_peconvolver_finish_convolver(peconvolver);
-        }
+      if (old_path != peconvolver->kernel_path) {
+        // the current engine keeps running until the new one replaces it
+        peconvolver->load_pending = true;
       }
     } else {
       // plugin is being initialized
@@ -307,135 +460,524 @@ static void gst_peconvolver_set_kernel_path(GstPeconvolver* peconvolver, gchar*
 }
 
 static void gst_peconvolver_set_ir_width(GstPeconvolver* peconvolver, const uint& value) {
-  if (value != peconvolver->ir_width) {
-    std::lock_guard<std::mutex> lock(peconvolver->lock_guard_zita);
+  // the streaming thread ramps to the new width in the next buffer
+
+  peconvolver->ir_width = value;
+}
+
+static void gst_peconvolver_set_tail_threshold(GstPeconvolver* peconvolver, const float& value) {
+  {
+    std::lock_guard<std::mutex> lock(peconvolver->lock_guard_params);
+
+    if (value != peconvolver->tail_threshold) {
+      peconvolver->tail_threshold = value;
+
+      // the kernel comes from the cache so this reload is cheap
+      peconvolver->load_pending = true;
+    }
+  }
+}
+
+/*
+  Resets the fifos for a new block size. The frames still in them are lost. It is called from the streaming thread or
+  while it is not running.
+*/
+
+static void gst_peconvolver_set_blocksize(GstPeconvolver* peconvolver, const uint& value) {
+  peconvolver->blocksize = value;
+
+  peconvolver->fifo_in.resize(2U * value);
+  peconvolver->fifo_out.resize(2U * value);
+
+  std::fill(peconvolver->fifo_out.begin(), peconvolver->fifo_out.end(), 0.0F);
+
+  peconvolver->fifo_pos = 0U;
+
+  peconvolver->load_pending = true;
+
+  util::debug(peconvolver->log_tag + "block size: " + std::to_string(value) + " frames");
+
+  // our latency changed
+
+  gst_element_post_message(GST_ELEMENT_CAST(peconvolver), gst_message_new_latency(GST_OBJECT_CAST(peconvolver)));
+}
+
+/*
+  Called from the streaming thread. It only hands the request to the loader thread. The kernel is read and zita is
+  configured without holding any lock the streaming thread needs. The loader mutex is only held for a few
+  assignments.
+*/
+
+static void gst_peconvolver_load_kernel(GstPeconvolver* peconvolver) {
+  if (!peconvolver->loader.joinable()) {
+    peconvolver->loader = std::thread(gst_peconvolver_loader, peconvolver);
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(peconvolver->loader_mutex);
+
+    // a request that was not started yet is replaced. A running load sees the new id and gives up
+
+    peconvolver->load_request.id = ++peconvolver->load_id;
+    peconvolver->load_request.rate = peconvolver->rate;
+    peconvolver->load_request.blocksize = peconvolver->blocksize;
+
+    peconvolver->load_requested = true;
+  }
+
+  peconvolver->loader_cv.notify_all();
+}
+
+/*
+  Loader thread. It builds one engine at a time for the most recent request. So the time between the last change and
+  a ready engine is never longer than one load plus the time the abandoned load takes to notice it. It also frees the
+  engines the streaming thread swaps out, so that they do not stay in memory until the next load.
+*/
+
+static void gst_peconvolver_loader(GstPeconvolver* peconvolver) {
+  std::unique_lock<std::mutex> lock(peconvolver->loader_mutex);
+
+  while (true) {
+    peconvolver->loader_cv.wait(lock, [=]() {
+      return peconvolver->loader_quit || peconvolver->load_requested || peconvolver->retired_engine.load() != nullptr;
+    });
+
+    if (peconvolver->loader_quit) {
+      return;
+    }
+
+    bool load = peconvolver->load_requested;
+    auto request = peconvolver->load_request;
 
-    peconvolver->ir_width = value;
+    peconvolver->load_requested = false;
+    peconvolver->loader_busy = true;
 
-    if (peconvolver->ready) {
-      // resetting zita
-      gst_peconvolver_finish_convolver(peconvolver);
+    lock.unlock();
+
+    // the engine swapped out by the streaming thread is not used anymore. This also makes room for the next swap
+
+    gst_peconvolver_free_retired_engine(peconvolver);
+
+    if (load && request.id == peconvolver->load_id) {
+      gst_peconvolver_setup_convolver(peconvolver, request.id, request.rate, request.blocksize);
     }
+
+    lock.lock();
+
+    peconvolver->loader_busy = false;
+
+    // finish_convolver may be waiting for us
+
+    peconvolver->loader_cv.notify_all();
   }
 }
 
-static void gst_peconvolver_setup_convolver(GstPeconvolver* peconvolver) {
-  if (!peconvolver->ready && peconvolver->rate != 0 && peconvolver->bpf != 0) {
-    bool irs_ok = rk::read_file(peconvolver);
+static void gst_peconvolver_setup_convolver(GstPeconvolver* peconvolver,
+                                            const uint& id,
+                                            const int& rate,
+                                            const uint& blocksize) {
+  if (rate == 0 || blocksize == 0U) {
+    return;
+  }
+
+  std::string path;
+  float tail_threshold = -100.0F;
+
+  {
+    std::lock_guard<std::mutex> lock(peconvolver->lock_guard_params);
+
+    if (peconvolver->kernel_path != nullptr) {
+      path = peconvolver->kernel_path;
+    }
+
+    tail_threshold = peconvolver->tail_threshold;
+  }
+
+  kc::Kernel kernel;
 
-    if (irs_ok) {
-      bool failed = false;
-      float density = 0.0F;
-      int max_size = peconvolver->kernel_n_frames, ret;
+  /*
+    An engine without a Convproc instance is a passthrough. It is published anyway so that the streaming thread
+    crossfades to the dry signal instead of keeping the previous impulse response.
+  */
+
+  auto* engine = new PeconvolverEngine();
+
+  engine->blocksize = blocksize;
+
+  // between the resampling chunks we check if a newer load was requested
+
+  bool irs_ok = rk::read_file(path, rate, kernel, [=]() { return id != peconvolver->load_id; });
+
+  if (id != peconvolver->load_id) {
+    gst_peconvolver_destroy_engine(engine);
+
+    util::debug(peconvolver->log_tag + "kernel load abandoned. A newer one was requested");
+
+    return;
+  }
+
+  if (irs_ok) {
+    rk::trim_tail(kernel, rate, tail_threshold);
+
+    bool failed = false;
+    float density = 0.0F;
+    int max_size = kernel.frames, ret;
+    uint n_outputs = 2U;
+
+    /*
+      Paths as {input, output, kernel}. zita transforms each input only once and reuses it in all the paths that
+      start from it, so a true stereo impulse response costs the same forward FFTs as a stereo one.
+
+      mono: out0 = L * k and out1 = R * k
+
+      stereo: the width is applied by mixing the outputs so every input goes through both kernels.
+      out0 = L * kL, out1 = L * kR, out2 = R * kR and out3 = R * kL
+
+      true stereo: paths to the same output are summed by zita. out0 = L * kLL + R * kRL and out1 = L * kLR + R * kRR
+    */
 
-      peconvolver->irs_fail_count = 0;
+    std::vector<std::array<uint, 3>> paths;
 
-      peconvolver->conv = new Convproc();
+    engine->layout = kernel.size();
 
-      unsigned int options = 0U;
+    switch (engine->layout) {
+      case rk::mono:
+        paths = {{0U, 0U, 0U}, {1U, 1U, 0U}};
+        break;
+      case rk::stereo:
+        n_outputs = 4U;
+        paths = {{0U, 0U, 0U}, {0U, 1U, 1U}, {1U, 2U, 1U}, {1U, 3U, 0U}};
+        break;
+      default:
+        paths = {{0U, 0U, 0U}, {0U, 1U, 1U}, {1U, 0U, 2U}, {1U, 1U, 3U}};
+        break;
+    }
+
+    engine->conv = new Convproc();
 
-      // depending on buffer and kernel size OPT_FFTW_MEASURE may make us crash
-      // options |= Convproc::OPT_FFTW_MEASURE;
-      options |= Convproc::OPT_VECTOR_MODE;
+    unsigned int options = 0U;
 
-      peconvolver->conv->set_options(options);
+    // depending on buffer and kernel size OPT_FFTW_MEASURE may make us crash
+    // options |= Convproc::OPT_FFTW_MEASURE;
+    options |= Convproc::OPT_VECTOR_MODE;
+
+    engine->conv->set_options(options);
 
 #if ZITA_CONVOLVER_MAJOR_VERSION == 3
-      peconvolver->conv->set_density(density);
+    engine->conv->set_density(density);
 
-      ret = peconvolver->conv->configure(2, 2, max_size, peconvolver->num_samples, peconvolver->num_samples,
-                                         Convproc::MAXPART);
+    ret = engine->conv->configure(2, n_outputs, max_size, blocksize, blocksize, Convproc::MAXPART);
 #endif
 
 #if ZITA_CONVOLVER_MAJOR_VERSION == 4
-      ret = peconvolver->conv->configure(2, 2, max_size, peconvolver->num_samples, peconvolver->num_samples,
-                                         Convproc::MAXPART, density);
+    ret = engine->conv->configure(2, n_outputs, max_size, blocksize, blocksize, Convproc::MAXPART, density);
 #endif
 
-      if (ret != 0) {
-        failed = true;
-        util::debug(peconvolver->log_tag + "can't initialise zita-convolver engine: " + std::to_string(ret));
-      }
+    if (ret != 0) {
+      failed = true;
+      util::debug(peconvolver->log_tag + "can't initialise zita-convolver engine: " + std::to_string(ret));
+    }
 
-      ret = peconvolver->conv->impdata_create(0, 0, 1, peconvolver->kernel_L.data(), 0, peconvolver->kernel_n_frames);
+    for (uint n = 0U; n < paths.size() && !failed; n++) {
+      auto [inp, out, k] = paths[n];
 
-      if (ret != 0) {
-        failed = true;
-        util::debug(peconvolver->log_tag + "left impdata_create failed: " + std::to_string(ret));
-      }
+      // paths using a kernel that was already partitioned share its data
 
-      ret = peconvolver->conv->impdata_create(1, 1, 1, peconvolver->kernel_R.data(), 0, peconvolver->kernel_n_frames);
+      auto first = std::find_if(paths.begin(), paths.begin() + n, [&](const auto& p) { return p[2] == k; });
 
-      if (ret != 0) {
-        failed = true;
-        util::debug(peconvolver->log_tag + "right impdata_create failed: " + std::to_string(ret));
-      }
+      if (first != paths.begin() + n) {
+#if ZITA_CONVOLVER_MAJOR_VERSION == 3
+        ret = engine->conv->impdata_copy((*first)[0], (*first)[1], inp, out);
+#endif
 
-      ret = peconvolver->conv->start_process(CONVPROC_SCHEDULER_PRIORITY, CONVPROC_SCHEDULER_CLASS);
+#if ZITA_CONVOLVER_MAJOR_VERSION == 4
+        ret = engine->conv->impdata_link((*first)[0], (*first)[1], inp, out);
+#endif
+      } else {
+        ret = engine->conv->impdata_create(inp, out, 1, kernel.channels[k], 0, max_size);
+      }
 
       if (ret != 0) {
         failed = true;
-        util::debug(peconvolver->log_tag + "start_process failed: " + std::to_string(ret));
+        util::debug(peconvolver->log_tag + "impdata failed for the path " + std::to_string(inp) + " -> " +
+                    std::to_string(out) + ": " + std::to_string(ret));
       }
+    }
 
-      peconvolver->ready = (failed) ? false : true;
-    } else {
-      util::debug(peconvolver->log_tag + "we will just passthrough data.");
+    // zita copied the kernel to its partitions. The mapping or the decoded kernel is not needed anymore
+
+    kernel.clear();
+
+    ret = engine->conv->start_process(CONVPROC_SCHEDULER_PRIORITY, CONVPROC_SCHEDULER_CLASS);
+
+    if (ret != 0) {
+      failed = true;
+      util::debug(peconvolver->log_tag + "start_process failed: " + std::to_string(ret));
+    }
+
+    if (failed) {
+      gst_peconvolver_destroy_engine(engine);
+
+      engine = new PeconvolverEngine();
 
-      peconvolver->ready = false;
-      peconvolver->irs_fail_count++;
+      engine->blocksize = blocksize;
     }
   }
+
+  if (engine->conv == nullptr) {
+    util::debug(peconvolver->log_tag + "we will just passthrough data.");
+  }
+
+  if (id != peconvolver->load_id) {
+    // a newer request was made while we were working
+
+    gst_peconvolver_destroy_engine(engine);
+
+    return;
+  }
+
+  // if there was an engine waiting it never reached the streaming thread. So it is safe to destroy it here
+
+  gst_peconvolver_destroy_engine(peconvolver->next_engine.exchange(engine));
+
+  /*
+    We do not wait for the streaming thread to crossfade to the new engine. It hands the one it replaces back to us
+    through the retired slot.
+  */
 }
 
-static void gst_peconvolver_process(GstPeconvolver* peconvolver, GstBuffer* buffer) {
-  if (peconvolver->ready) {
-    GstMapInfo map;
+static void gst_peconvolver_run_engine(GstPeconvolver* peconvolver, PeconvolverEngine* engine, const float* data) {
+  // deinterleave
+  for (unsigned int n = 0U; n < engine->blocksize; n++) {
+    engine->conv->inpdata(0)[n] = data[2U * n];
+    engine->conv->inpdata(1)[n] = data[2U * n + 1U];
+  }
+
+  int ret = engine->conv->process(THREAD_SYNC_MODE);
 
-    gst_buffer_map(buffer, &map, GST_MAP_READWRITE);
+  if (ret != 0) {
+    util::debug(peconvolver->log_tag + "IR: process failed: " + std::to_string(ret));
+  }
+}
 
-    // deinterleave
-    for (unsigned int n = 0U; n < peconvolver->num_samples; n++) {
-      peconvolver->conv->inpdata(0)[n] = (reinterpret_cast<float*>(map.data))[2U * n];
-      peconvolver->conv->inpdata(1)[n] = (reinterpret_cast<float*>(map.data))[2U * n + 1U];
+/*
+  Output of the engine for the frame n with the mid-side coefficient x. A missing or passthrough engine gives the dry
+  signal.
+*/
+
+static inline void gst_peconvolver_get_output(PeconvolverEngine* engine,
+                                              const bool& engine_ok,
+                                              const float* data,
+                                              const unsigned int& n,
+                                              const float& x,
+                                              float& L,
+                                              float& R) {
+  if (engine_ok) {
+    switch (engine->layout) {
+      case rk::mono:
+        // both channels see the same kernel. There is no stereo image to change
+        L = engine->conv->outdata(0)[n];
+        R = engine->conv->outdata(1)[n];
+        break;
+      case rk::stereo:
+        L = engine->conv->outdata(0)[n] + x * engine->conv->outdata(1)[n];
+        R = engine->conv->outdata(2)[n] + x * engine->conv->outdata(3)[n];
+        break;
+      default:
+        L = engine->conv->outdata(0)[n] + x * engine->conv->outdata(1)[n];
+        R = engine->conv->outdata(1)[n] + x * engine->conv->outdata(0)[n];
+        break;
     }
+  } else {
+    L = data[2U * n];
+    R = data[2U * n + 1U];
+  }
+}
 
-    int ret = peconvolver->conv->process(THREAD_SYNC_MODE);
+/*
+  Convolves the block in the input fifo and writes the result to the output fifo. Without an engine the block is
+  copied so that the latency does not change.
+*/
 
-    if (ret != 0) {
-      util::debug(peconvolver->log_tag + "IR: process failed: " + std::to_string(ret));
+static void gst_peconvolver_process(GstPeconvolver* peconvolver) {
+  PeconvolverEngine* engine = peconvolver->engine.load();
+  PeconvolverEngine* incoming = nullptr;
+
+  // we can only swap engines when there is room to retire the current one
+
+  if (peconvolver->next_engine.load() != nullptr && peconvolver->retired_engine.load() == nullptr) {
+    incoming = peconvolver->next_engine.exchange(nullptr);
+
+    if (incoming != nullptr && incoming->blocksize != peconvolver->blocksize) {
+      // it was built for a block size we are not using anymore
+
+      gst_peconvolver_retire_engine(peconvolver, incoming);
+
+      incoming = nullptr;
+    }
+  }
+
+  bool engine_ok = engine != nullptr && engine->conv != nullptr && engine->blocksize == peconvolver->blocksize;
+  bool incoming_ok = incoming != nullptr && incoming->conv != nullptr;
+
+  // the width ramps from the value used in the previous block to the current one
+
+  float x0 = peconvolver->ms_coeff;
+  float x1 = rk::ms_coefficient(peconvolver->ir_width.load());
+
+  peconvolver->ms_coeff = x1;
+
+  const float* data = peconvolver->fifo_in.data();
+  float* out = peconvolver->fifo_out.data();
+
+  if (!engine_ok && incoming == nullptr) {
+    std::memcpy(out, data, 2U * peconvolver->blocksize * sizeof(float));
+
+    return;
+  }
+
+  if (engine_ok) {
+    gst_peconvolver_run_engine(peconvolver, engine, data);
+  }
+
+  if (incoming_ok) {
+    gst_peconvolver_run_engine(peconvolver, incoming, data);
+  }
+
+  float dw = 1.0F / static_cast<float>(peconvolver->blocksize);
+  float dx = (x1 - x0) * dw;
+  float L, R;
+
+  if (incoming == nullptr) {
+    for (unsigned int n = 0U; n < peconvolver->blocksize; n++) {
+      gst_peconvolver_get_output(engine, true, data, n, x0 + static_cast<float>(n + 1U) * dx, L, R);
+
+      out[2U * n] = L;
+      out[2U * n + 1U] = R;
     }
+  } else {
+    /*
+      Crossfading from the old to the new engine over this block. A missing engine or a passthrough one
+      contributes with the dry signal.
+    */
+
+    float new_L, new_R;
+
+    for (unsigned int n = 0U; n < peconvolver->blocksize; n++) {
+      float w = static_cast<float>(n + 1U) * dw;
+      float x = x0 + static_cast<float>(n + 1U) * dx;
 
-    // interleave
-    for (unsigned int n = 0U; n < peconvolver->num_samples; n++) {
-      (reinterpret_cast<float*>(map.data))[2U * n] = peconvolver->conv->outdata(0)[n];
-      (reinterpret_cast<float*>(map.data))[2U * n + 1U] = peconvolver->conv->outdata(1)[n];
+      gst_peconvolver_get_output(engine, engine_ok, data, n, x, L, R);
+      gst_peconvolver_get_output(incoming, incoming_ok, data, n, x, new_L, new_R);
+
+      out[2U * n] = (1.0F - w) * L + w * new_L;
+      out[2U * n + 1U] = (1.0F - w) * R + w * new_R;
     }
 
-    gst_buffer_unmap(buffer, &map);
+    peconvolver->engine.store(incoming);
+
+    // the retired slot is empty. We checked it before taking the new engine
+
+    gst_peconvolver_retire_engine(peconvolver, engine);
   }
 }
 
-static void gst_peconvolver_finish_convolver(GstPeconvolver* peconvolver) {
-  peconvolver->irs_fail_count = 0;
+static gboolean gst_peconvolver_query(GstBaseTransform* trans, GstPadDirection direction, GstQuery* query) {
+  GstPeconvolver* peconvolver = GST_PECONVOLVER(trans);
+
+  if (direction == GST_PAD_SRC && GST_QUERY_TYPE(query) == GST_QUERY_LATENCY) {
+    gboolean ret = gst_pad_peer_query(GST_BASE_TRANSFORM_SINK_PAD(trans), query);
 
-  if (peconvolver->ready) {
-    peconvolver->ready = false;
+    if (ret && peconvolver->rate > 0) {
+      gboolean live;
+      GstClockTime min, max;
 
-    if (peconvolver->conv != nullptr) {
-      if (peconvolver->conv->state() != Convproc::ST_STOP) {
-        peconvolver->conv->stop_process();
+      gst_query_parse_latency(query, &live, &min, &max);
 
-        peconvolver->conv->cleanup();
+      /* add our own latency */
 
-        delete peconvolver->conv;
+      GstClockTime latency = gst_util_uint64_scale_round(peconvolver->blocksize, GST_SECOND, peconvolver->rate);
 
-        peconvolver->conv = nullptr;
+      min += latency;
+
+      if (max != GST_CLOCK_TIME_NONE) {
+        max += latency;
       }
+
+      gst_query_set_latency(query, live, min, max);
     }
 
-    peconvolver->futures.clear();
+    return ret;
   }
+
+  return GST_BASE_TRANSFORM_CLASS(gst_peconvolver_parent_class)->query(trans, direction, query);
+}
+
+static void gst_peconvolver_destroy_engine(PeconvolverEngine* engine) {
+  if (engine == nullptr) {
+    return;
+  }
+
+  if (engine->conv != nullptr) {
+    if (engine->conv->state() != Convproc::ST_STOP) {
+      engine->conv->stop_process();
+    }
+
+    engine->conv->cleanup();
+
+    delete engine->conv;
+  }
+
+  delete engine;
+}
+
+static void gst_peconvolver_free_retired_engine(GstPeconvolver* peconvolver) {
+  gst_peconvolver_destroy_engine(peconvolver->retired_engine.exchange(nullptr));
+}
+
+/*
+  Called from the streaming thread. stop_process joins the zita threads, so the engine is freed by the loader. The
+  loader mutex is only taken to make sure the loader is either waiting or will see the retired engine before it
+  waits again.
+*/
+
+static void gst_peconvolver_retire_engine(GstPeconvolver* peconvolver, PeconvolverEngine* engine) {
+  if (engine == nullptr) {
+    return;
+  }
+
+  peconvolver->retired_engine.store(engine);
+
+  {
+    std::lock_guard<std::mutex> lock(peconvolver->loader_mutex);
+  }
+
+  peconvolver->loader_cv.notify_all();
+}
+
+/*
+  It must not be called while the streaming thread is inside transform_ip. This is the case for setup, stop and
+  finalize.
+*/
+
+static void gst_peconvolver_finish_convolver(GstPeconvolver* peconvolver) {
+  // a running load sees that its id is outdated and stops. We wait for it so that it can not publish its engine
+
+  {
+    std::unique_lock<std::mutex> lock(peconvolver->loader_mutex);
+
+    peconvolver->load_id++;
+
+    peconvolver->load_requested = false;
+
+    peconvolver->loader_cv.wait(lock, [=]() { return !peconvolver->loader_busy; });
+  }
+
+  gst_peconvolver_destroy_engine(peconvolver->engine.exchange(nullptr));
+  gst_peconvolver_destroy_engine(peconvolver->next_engine.exchange(nullptr));
+  gst_peconvolver_destroy_engine(peconvolver->retired_engine.exchange(nullptr));
+
+  peconvolver->load_pending = true;
 }
 
 static gboolean plugin_init(GstPlugin* plugin) {
@@ -22,8 +22,10 @@
 
 #include <gst/audio/gstaudiofilter.h>
 #include <zita-convolver.h>
-#include <future>
+#include <atomic>
+#include <condition_variable>
 #include <mutex>
+#include <thread>
 #include <vector>
 
 G_BEGIN_DECLS
@@ -34,29 +36,84 @@ G_BEGIN_DECLS
 #define GST_IS_PECONVOLVER(obj) (G_TYPE_CHECK_INSTANCE_TYPE((obj), GST_TYPE_PECONVOLVER))
 #define GST_IS_PECONVOLVER_CLASS(obj) (G_TYPE_CHECK_CLASS_TYPE((klass), GST_TYPE_PECONVOLVER))
 
+/*
+  Smaller partitions lower the latency but zita has to do more work to convolve the same kernel.
+*/
+
+enum GstPeconvolverPartitioning {
+  PECONVOLVER_PARTITIONING_MIN_LATENCY,
+  PECONVOLVER_PARTITIONING_BALANCED,
+  PECONVOLVER_PARTITIONING_MIN_CPU
+};
+
+/*
+  A fully configured zita engine. It is built by the loader thread, handed to the streaming thread through an atomic
+  pointer and always destroyed outside of it.
+*/
+
+struct PeconvolverEngine {
+  Convproc* conv = nullptr;
+  uint blocksize = 0U;  // zita quantum. It has to match the size of the blocks we give to zita
+  uint layout = 0U;     // number of channels in the impulse response: mono, stereo or true stereo
+};
+
+/*
+  What the loader needs to build an engine. Only the most recent request is kept. The kernel path and the tail
+  threshold are read when the load starts so they are always the latest ones too.
+*/
+
+struct PeconvolverLoadRequest {
+  uint id = 0U;  // value of load_id when the request was made
+  int rate = 0;
+  uint blocksize = 0U;
+};
+
 struct GstPeconvolver {
   GstAudioFilter base_peconvolver;
 
   /* properties */
 
   gchar* kernel_path = nullptr;
-  unsigned int ir_width, num_samples;
+  float tail_threshold;                // energy decay level in dB where the kernel is cut
+  std::atomic<unsigned int> ir_width;  // applied by the streaming thread. It does not need a new engine
+  std::atomic<int> partitioning;       // selects the block size. See GstPeconvolverPartitioning
 
   /* < private > */
 
-  bool ready;
-  int rate, kernel_n_frames, irs_fail_count;
-  int bpf;                      // bytes per frame : channels * bps
-  std::vector<float> kernel_L;  // left channel buffer
-  std::vector<float> kernel_R;  // right channel buffer
+  unsigned int blocksize;      // zita quantum and size of its first partition. It is our latency
+  unsigned int quantum;        // frames in the buffers we receive once two in a row have the same size. 0 until then
+  unsigned int buffer_frames;  // frames in the last buffer
+  unsigned int fifo_pos;       // frames in the input fifo
+  float ms_coeff;              // mid-side coefficient used in the last block. The next one ramps from it
+
+  std::vector<float> fifo_in, fifo_out;  // interleaved blocks of blocksize frames
+
+  int rate;
+  int bpf;  // bytes per frame : channels * bps
 
   std::string log_tag;
 
-  Convproc* conv = nullptr;
+  std::atomic<PeconvolverEngine*> engine;          // engine used by the streaming thread
+  std::atomic<PeconvolverEngine*> next_engine;     // engine waiting to be crossfaded in by the streaming thread
+  std::atomic<PeconvolverEngine*> retired_engine;  // engine swapped out by the streaming thread. Freed by the loader
+
+  std::atomic<bool> load_pending;  // a new engine has to be built
+  std::atomic<uint> load_id;       // identifies the most recent load request. Older loads discard their work
+
+  std::mutex lock_guard_params;  // protects kernel_path and tail_threshold. Never taken by the streaming thread
 
-  std::mutex lock_guard_zita;
+  /*
+    A single worker thread builds the engines. Requests made while it is busy replace each other and the running
+    load is abandoned as soon as it sees a newer load_id.
+  */
 
-  std::vector<std::future<void>> futures;
+  std::thread loader;
+  std::mutex loader_mutex;  // protects the fields below
+  std::condition_variable loader_cv;
+  PeconvolverLoadRequest load_request;
+  bool load_requested;  // load_request has not been taken by the loader yet
+  bool loader_busy;     // the loader is building an engine
+  bool loader_quit;
 };
 
 struct GstPeconvolverClass {
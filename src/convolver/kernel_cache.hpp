@@ -0,0 +1,261 @@
+/*
+ *  Copyright © 2017-2020 Wellington Wallace
+ *
+ *  This file is part of PulseEffects.
+ *
+ *  PulseEffects is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  PulseEffects is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with PulseEffects.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef KERNEL_CACHE_HPP
+#define KERNEL_CACHE_HPP
+
+#include <fcntl.h>
+#include <glib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "file_cache.hpp"
+#include "util.hpp"
+
+/*
+  Kernels that are ready to be given to zita are stored in the user cache dir so that we do not have to decode and
+  resample the impulse response file every time the pipeline is restarted. A cache file is a fixed size header
+  followed by the channels as planar native endian floats. Being planar it is mapped and given to zita without any
+  parsing or copy. The least recently used files are removed when the directory grows beyond max_cache_size.
+*/
+
+namespace kc {
+
+constexpr char magic[8] = {'P', 'E', 'K', 'E', 'R', 'N', 'E', 'L'};
+constexpr uint32_t version = 3U;
+constexpr uint32_t max_path_size = 4096U;
+constexpr uint64_t max_cache_size = 512U * 1024U * 1024U;  // bytes
+
+struct Header {
+  char magic[8];
+  uint32_t version;
+  uint32_t rate;    // rate the kernel was resampled to
+  uint32_t channels;
+  uint32_t frames;  // frames in each channel
+  int64_t mtime_sec;
+  int64_t mtime_nsec;
+  uint32_t path_size;
+  char path[max_path_size];  // used to detect hash collisions
+};
+
+/*
+  Planar channels of the same length, the way zita wants them. They point either to a private mapping of a cache file
+  or to vectors owned by this class. The mapping is copy on write, so the tail fade out only copies the pages it
+  changes.
+*/
+
+class Kernel {
+ public:
+  Kernel() = default;
+  Kernel(const Kernel&) = delete;
+  auto operator=(const Kernel&) -> Kernel& = delete;
+  Kernel(const Kernel&&) = delete;
+  auto operator=(const Kernel&&) -> Kernel& = delete;
+  ~Kernel() { clear(); }
+
+  std::vector<float*> channels;
+
+  uint frames = 0U;  // in each channel
+
+  [[nodiscard]] auto size() const -> uint { return channels.size(); }
+
+  // takes the ownership of a mapping holding nchannels planar channels of nframes starting at offset
+
+  void map(void* addr, const size_t& size, const size_t& offset, const uint& nchannels, const uint& nframes) {
+    clear();
+
+    map_addr = addr;
+    map_size = size;
+
+    auto* data = reinterpret_cast<float*>(static_cast<char*>(addr) + offset);
+
+    for (uint c = 0U; c < nchannels; c++) {
+      channels.emplace_back(data + static_cast<size_t>(c) * nframes);
+    }
+
+    frames = nframes;
+  }
+
+  // the vectors are moved. They must have the same size
+
+  void adopt(std::vector<std::vector<float>>& data) {
+    clear();
+
+    storage = std::move(data);
+
+    for (auto& d : storage) {
+      channels.emplace_back(d.data());
+    }
+
+    frames = storage.empty() ? 0U : storage[0].size();
+  }
+
+  void clear() {
+    channels.clear();
+    storage.clear();
+
+    frames = 0U;
+
+    if (map_addr != nullptr) {
+      munmap(map_addr, map_size);
+
+      map_addr = nullptr;
+      map_size = 0U;
+    }
+  }
+
+ private:
+  std::vector<std::vector<float>> storage;
+
+  void* map_addr = nullptr;
+  size_t map_size = 0U;
+};
+
+inline auto get_mtime(const std::string& path, int64_t& sec, int64_t& nsec) -> bool {
+  struct stat st {};
+
+  if (stat(path.c_str(), &st) != 0) {
+    return false;
+  }
+
+  sec = st.st_mtim.tv_sec;
+  nsec = st.st_mtim.tv_nsec;
+
+  return true;
+}
+
+inline auto get_cache_file(const std::string& path, const int& rate) -> std::string {
+  return file_cache::get_file("convolver", path + ":" + std::to_string(rate), ".kernel");
+}
+
+/*
+  Returns false if there is no valid entry for this key. Entries made before the impulse response file was modified
+  are ignored and will be overwritten by the next store.
+*/
+
+inline auto load(const std::string& path, const int& rate, Kernel& kernel) -> bool {
+  int64_t sec = 0, nsec = 0;
+
+  if (path.size() >= max_path_size || !get_mtime(path, sec, nsec)) {
+    return false;
+  }
+
+  auto cache_file = get_cache_file(path, rate);
+
+  int fd = open(cache_file.c_str(), O_RDONLY | O_CLOEXEC);
+
+  if (fd < 0) {
+    return false;
+  }
+
+  struct stat st {};
+
+  if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(Header)) {
+    close(fd);
+
+    return false;
+  }
+
+  auto size = static_cast<size_t>(st.st_size);
+
+  void* addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+
+  close(fd);
+
+  if (addr == MAP_FAILED) {
+    return false;
+  }
+
+  auto* header = static_cast<const Header*>(addr);
+
+  bool valid = std::memcmp(header->magic, magic, sizeof(magic)) == 0 && header->version == version &&
+               header->rate == static_cast<uint32_t>(rate) && header->mtime_sec == sec && header->mtime_nsec == nsec &&
+               header->path_size == path.size() && std::memcmp(header->path, path.c_str(), path.size()) == 0 &&
+               header->frames > 0U && header->channels > 0U &&
+               size == sizeof(Header) + header->channels * header->frames * sizeof(float);
+
+  if (!valid) {
+    munmap(addr, size);
+
+    return false;
+  }
+
+  kernel.map(addr, size, sizeof(Header), header->channels, header->frames);
+
+  file_cache::touch(cache_file);
+
+  util::debug("convolver: kernel mapped from cache: " + cache_file);
+
+  return true;
+}
+
+inline void store(const std::string& path, const int& rate, const std::vector<std::vector<float>>& kernel) {
+  int64_t sec = 0, nsec = 0;
+
+  if (path.size() >= max_path_size || kernel.empty() || kernel[0].empty() || !get_mtime(path, sec, nsec)) {
+    return;
+  }
+
+  for (auto& k : kernel) {
+    if (k.size() != kernel[0].size()) {
+      return;
+    }
+  }
+
+  Header header{};
+
+  std::memcpy(header.magic, magic, sizeof(magic));
+
+  header.version = version;
+  header.rate = rate;
+  header.channels = kernel.size();
+  header.frames = kernel[0].size();
+  header.mtime_sec = sec;
+  header.mtime_nsec = nsec;
+  header.path_size = path.size();
+
+  std::memcpy(header.path, path.c_str(), path.size());
+
+  auto cache_file = get_cache_file(path, rate);
+
+  bool ok = file_cache::write("convolver", cache_file, [&](FILE* f) {
+    bool written = fwrite(&header, sizeof(Header), 1, f) == 1;
+
+    for (auto& k : kernel) {
+      written = written && fwrite(k.data(), sizeof(float), k.size(), f) == k.size();
+    }
+
+    return written;
+  });
+
+  if (ok) {
+    util::debug("convolver: kernel saved to cache: " + cache_file);
+
+    file_cache::trim("convolver", ".kernel", max_cache_size);
+  }
+}
+
+}  // namespace kc
+
+#endif
@@ -21,176 +21,338 @@
 #define READ_KERNEL_HPP
 
 #include <samplerate.h>
+#include <algorithm>
 #include <cmath>
 #include <cstdint>
 #include <cstring>
+#include <functional>
 #include <iostream>
 #include <sndfile.hh>
-#include "gstpeconvolver.hpp"
+#include <string>
+#include <vector>
+#include "kernel_cache.hpp"
 #include "util.hpp"
 
 namespace rk {
 
 std::string log_tag = "convolver: ";
 
-void autogain(std::vector<float>& left, std::vector<float>& right) {
+constexpr uint resampler_chunk_size = 16384U;  // frames decoded and resampled at a time by read_file
+
+/*
+  Layouts of the impulse response files we support. The channels of a true stereo file are in the order LL, LR, RL,
+  RR where the first letter is the input and the second the output.
+*/
+
+enum Layout : uint { mono = 1U, stereo = 2U, true_stereo = 4U };
+
+void autogain(std::vector<std::vector<float>>& kernel) {
   float power = 0.0F, peak = 0.0F;
 
-  for (uint n = 0U; n < left.size(); n++) {
-    peak = (left[n] > peak) ? left[n] : peak;
-    peak = (right[n] > peak) ? right[n] : peak;
+  for (auto& k : kernel) {
+    for (uint n = 0U; n < k.size(); n++) {
+      peak = (k[n] > peak) ? k[n] : peak;
+    }
   }
 
   // normalize
-  for (uint n = 0U; n < left.size(); n++) {
-    left[n] /= peak;
-    right[n] /= peak;
+  for (auto& k : kernel) {
+    for (uint n = 0U; n < k.size(); n++) {
+      k[n] /= peak;
+    }
   }
 
-  // find average power
-  for (uint n = 0U; n < left.size(); n++) {
-    power += left[n] * left[n] + right[n] * right[n];
+  // find average power per output channel
+
+  for (auto& k : kernel) {
+    for (uint n = 0U; n < k.size(); n++) {
+      power += k[n] * k[n];
+    }
   }
 
-  power *= 0.5F;
+  if (kernel.size() != mono) {
+    power *= 0.5F;
+  }
 
   float autogain = std::min(1.0F, 1.0F / sqrtf(power));
 
   util::debug(log_tag + "autogain factor: " + std::to_string(autogain));
 
-  for (uint n = 0U; n < left.size(); n++) {
-    left[n] *= autogain;
-    right[n] *= autogain;
+  for (auto& k : kernel) {
+    for (uint n = 0U; n < k.size(); n++) {
+      k[n] *= autogain;
+    }
   }
 }
 
 /* Mid-Side based Stereo width effect
    taken from https://github.com/tomszilagyi/ir.lv2/blob/automatable/ir.cc
+
+   Instead of mixing the kernels we mix the outputs of the paths L->L, L->R, R->R and R->L. The result is the same
+   but the width can be changed without rebuilding the zita engine.
 */
-void ms_stereo(float width, std::vector<float>& left, std::vector<float>& right) {
+float ms_coefficient(const float& width) {
   float w = width / 100.0F;
-  float x = (1.0F - w) / (1.0F + w); /* M-S coeff.; L_out = L + x*R; R_out = x*L + R */
 
-  for (uint i = 0U; i < left.size(); i++) {
-    float L = left[i], R = right[i];
+  return (1.0F - w) / (1.0F + w); /* M-S coeff.; L_out = L + x*R; R_out = x*L + R */
+}
+
+/*
+  Energy decay curve based tail trimming. The kernel is cut where the energy that is still to come falls below
+  threshold_db relative to its total energy. A short fade out avoids a step at the new end. Returns the new length.
+*/
+
+uint trim_tail(kc::Kernel& kernel, const int& rate, const float& threshold_db) {
+  uint length = kernel.frames;
+
+  double total = 0.0;
+
+  for (auto* k : kernel.channels) {
+    for (uint n = 0U; n < length; n++) {
+      total += static_cast<double>(k[n]) * k[n];
+    }
+  }
+
+  if (total <= 0.0) {
+    return length;
+  }
+
+  double limit = total * std::pow(10.0, threshold_db / 10.0);
+  double tail = 0.0;
+  uint cut = 0U;
+
+  // Schroeder backward integration
+
+  for (uint n = length; n > 0U; n--) {
+    for (auto* k : kernel.channels) {
+      tail += static_cast<double>(k[n - 1U]) * k[n - 1U];
+    }
 
-    left[i] = L + x * R;
-    right[i] = R + x * L;
+    if (tail > limit) {
+      cut = n;
+
+      break;
+    }
   }
+
+  if (cut == 0U || cut == length) {
+    return length;
+  }
+
+  // 10 ms raised cosine fade out
+
+  uint fade = std::min(cut, static_cast<uint>(0.01F * rate));
+
+  for (auto* k : kernel.channels) {
+    for (uint n = 0U; n < fade; n++) {
+      k[cut - fade + n] *= 0.5F * (1.0F + cosf(static_cast<float>(M_PI) * static_cast<float>(n + 1U) / fade));
+    }
+  }
+
+  // zita is only given the first cut frames
+
+  kernel.frames = cut;
+
+  util::debug(log_tag + "tail below " + std::to_string(threshold_db) + " dB trimmed. Length: " +
+              std::to_string(length) + " -> " + std::to_string(cut) + " frames");
+
+  return cut;
 }
 
-bool read_file(GstPeconvolver* peconvolver) {
-  if (peconvolver->kernel_path == nullptr) {
+/*
+  Reads the impulse response in path and leaves it ready to be given to zita: resampled to rate, deinterleaved and
+  normalized. There is one kernel per channel in the file. The result is kept in the kernel cache. It does not touch
+  the element so it can run in parallel with the streaming thread. The work is abandoned as soon as cancelled returns
+  true. It is checked between the resampling chunks.
+*/
+
+bool read_file(const std::string& path,
+               const int& rate,
+               kc::Kernel& output,
+               const std::function<bool()>& cancelled) {
+  if (path.empty()) {
     util::debug(log_tag + "irs file path is null");
 
     return false;
   }
 
-  SndfileHandle file = SndfileHandle(peconvolver->kernel_path);
+  if (kc::load(path, rate, output)) {
+    return true;
+  }
+
+  std::vector<std::vector<float>> kernel;
+
+  SndfileHandle file = SndfileHandle(path);
 
   if (file.channels() == 0 || file.frames() == 0) {
-    util::debug(log_tag + "irs file does not exists or it is empty: " + peconvolver->kernel_path);
+    util::debug(log_tag + "irs file does not exists or it is empty: " + path);
 
     return false;
   }
 
-  util::debug(log_tag + "irs file: " + peconvolver->kernel_path);
+  util::debug(log_tag + "irs file: " + path);
   util::debug(log_tag + "irs rate: " + std::to_string(file.samplerate()) + " Hz");
   util::debug(log_tag + "irs channels: " + std::to_string(file.channels()));
   util::debug(log_tag + "irs frames: " + std::to_string(file.frames()));
 
-  // for now only stereo irs files are supported
+  uint channels = file.channels();
 
-  if (file.channels() == 2) {
-    bool resample = false;
-    float resample_ratio = 1.0F;
-    uint total_frames_in, total_frames_out, frames_in, frames_out;
+  if (channels != mono && channels != stereo && channels != true_stereo) {
+    util::debug(log_tag + "only mono, stereo and true stereo impulse responses are supported." +
+                "The impulse file was not loaded!");
 
-    frames_in = file.frames();
-    total_frames_in = file.channels() * frames_in;
+    return false;
+  }
 
-    std::vector<float> buffer(total_frames_in);
+  uint frames_in = file.frames();
+  uint frames_out = frames_in;
 
-    file.readf(buffer.data(), frames_in);
+  bool resample = file.samplerate() != rate;
+  double resample_ratio = static_cast<double>(rate) / file.samplerate();
 
-    if (file.samplerate() != peconvolver->rate) {
-      resample = true;
+  if (resample) {
+    frames_out = ceil(frames_in * resample_ratio);
 
-      resample_ratio = static_cast<float>(peconvolver->rate) / file.samplerate();
+    util::debug(log_tag + "resampling irs to " + std::to_string(rate) + " Hz");
+  } else {
+    util::debug(log_tag + "irs file does not need resampling");
+  }
 
-      frames_out = ceil(file.frames() * resample_ratio);
-      total_frames_out = file.channels() * frames_out;
-    } else {
-      frames_out = frames_in;
-      total_frames_out = file.channels() * frames_out;
-    }
+  /*
+    The file is decoded, resampled and deinterleaved one chunk at a time straight into the kernel. Besides the kernel
+    we only allocate two chunk sized buffers whatever the size of the file. This also lets a load that is not
+    wanted anymore stop between two chunks.
+  */
 
-    // allocate arrays
+  kernel.assign(channels, std::vector<float>(frames_out, 0.0F));
 
-    std::vector<float> kernel(total_frames_out);
+  uint out_chunk_size = resampler_chunk_size;
 
-    peconvolver->kernel_L.resize(frames_out);
-    peconvolver->kernel_R.resize(frames_out);
-    peconvolver->kernel_n_frames = frames_out;
+  if (resample) {
+    out_chunk_size = ceil(resampler_chunk_size * resample_ratio) + 16U;
+  }
 
-    // resample if necessary
+  std::vector<float> buffer_in(channels * resampler_chunk_size), buffer_out(channels * out_chunk_size);
 
-    if (resample) {
-      util::debug(log_tag + "resampling irs to " + std::to_string(peconvolver->rate) + " Hz");
+  uint pos_in = 0U, pos_out = 0U;
 
-      SRC_STATE* src_state = src_new(SRC_SINC_BEST_QUALITY, file.channels(), nullptr);
+  auto deinterleave = [&](const float* data, const uint& count) {
+    uint n_frames = std::min(count, frames_out - pos_out);
 
-      SRC_DATA src_data;
+    for (uint n = 0U; n < n_frames; n++) {
+      for (uint c = 0U; c < channels; c++) {
+        kernel[c][pos_out + n] = data[channels * n + c];
+      }
+    }
 
-      /* code from
-       * https://github.com/x42/convoLV2/blob/master/convolution.cc
-       */
+    pos_out += n_frames;
+  };
 
-      // The number of frames of data pointed to by data_in
-      src_data.input_frames = frames_in;
+  SRC_STATE* src_state = nullptr;
+  SRC_DATA src_data{};
 
-      // A pointer to the input data samples
-      src_data.data_in = buffer.data();
+  if (resample) {
+    int error = 0;
 
-      // Maximum number of frames pointer to by data_out
-      src_data.output_frames = frames_out;
+    src_state = src_new(SRC_SINC_BEST_QUALITY, channels, &error);
 
-      // A pointer to the output data samples
-      src_data.data_out = kernel.data();
+    if (src_state == nullptr) {
+      util::debug(log_tag + "could not create the resampler: " + src_strerror(error));
 
-      // Equal to output_sample_rate / input_sample_rate
-      src_data.src_ratio = resample_ratio;
+      return false;
+    }
 
-      // Equal to 0 if more input data is available and 1 otherwise
-      src_data.end_of_input = 1;
+    // Equal to output_sample_rate / input_sample_rate
+    src_data.src_ratio = resample_ratio;
+  }
 
-      src_process(src_state, &src_data);
+  bool ok = true;
 
-      src_delete(src_state);
+  while (pos_in < frames_in && pos_out < frames_out) {
+    if (cancelled()) {
+      util::debug(log_tag + "irs loading cancelled");
 
-      util::debug(log_tag + "irs frames after resampling " + std::to_string(frames_out));
-    } else {
-      util::debug(log_tag + "irs file does not need resampling");
+      ok = false;
 
-      std::memcpy(kernel.data(), buffer.data(), total_frames_in * sizeof(float));
+      break;
     }
 
-    // deinterleave
-    for (uint n = 0U; n < frames_out; n++) {
-      peconvolver->kernel_L[n] = kernel[2U * n];
-      peconvolver->kernel_R[n] = kernel[2U * n + 1U];
+    auto count = static_cast<uint>(file.readf(buffer_in.data(), std::min(frames_in - pos_in, resampler_chunk_size)));
+
+    if (count == 0U) {
+      // the file is shorter than its header says. What is missing stays zero
+      break;
     }
 
-    autogain(peconvolver->kernel_L, peconvolver->kernel_R);
+    pos_in += count;
 
-    ms_stereo(peconvolver->ir_width, peconvolver->kernel_L, peconvolver->kernel_R);
+    if (!resample) {
+      deinterleave(buffer_in.data(), count);
 
-    return true;
-  } else {
-    util::debug(log_tag + "only stereo impulse responses are supported." + "The impulse file was not loaded!");
+      continue;
+    }
+
+    src_data.data_in = buffer_in.data();
+    src_data.input_frames = count;
+
+    // Equal to 0 if more input data is available and 1 otherwise
+    src_data.end_of_input = (pos_in == frames_in) ? 1 : 0;
+
+    /*
+      libsamplerate may not consume the whole chunk in one call. After the last one it may also need a few more
+      calls to flush its internal buffer.
+    */
+
+    while (pos_out < frames_out) {
+      src_data.data_out = buffer_out.data();
+      src_data.output_frames = out_chunk_size;
+
+      int error = src_process(src_state, &src_data);
+
+      if (error != 0) {
+        util::debug(log_tag + "resampling failed: " + src_strerror(error));
+
+        ok = false;
+
+        break;
+      }
+
+      deinterleave(buffer_out.data(), src_data.output_frames_gen);
+
+      src_data.data_in += channels * src_data.input_frames_used;
+      src_data.input_frames -= src_data.input_frames_used;
+
+      if (src_data.input_frames == 0 && (src_data.end_of_input == 0 || src_data.output_frames_gen == 0)) {
+        break;
+      }
+    }
+
+    if (!ok) {
+      break;
+    }
+  }
+
+  if (src_state != nullptr) {
+    src_delete(src_state);
+  }
+
+  if (!ok) {
+    kernel.clear();
 
     return false;
   }
+
+  if (resample) {
+    util::debug(log_tag + "irs frames after resampling " + std::to_string(frames_out));
+  }
+
+  autogain(kernel);
+
+  kc::store(path, rate, kernel);
+
+  output.adopt(kernel);
+
+  return true;
 }
 
 }  // namespace rk
@@ -35,6 +35,10 @@ void ConvolverPreset::save(boost::property_tree::ptree& root,
   root.put(section + ".convolver.kernel-path", settings->get_string("kernel-path"));
 
   root.put(section + ".convolver.ir-width", settings->get_int("ir-width"));
+
+  root.put(section + ".convolver.partitioning", settings->get_string("partitioning"));
+
+  root.put(section + ".convolver.tail-threshold", settings->get_double("tail-threshold"));
 }
 
 void ConvolverPreset::load(const boost::property_tree::ptree& root,
@@ -49,6 +53,10 @@ void ConvolverPreset::load(const boost::property_tree::ptree& root,
   update_string_key(root, settings, "kernel-path", section + ".convolver.kernel-path");
 
   update_key<int>(root, settings, "ir-width", section + ".convolver.ir-width");
+
+  update_string_key(root, settings, "partitioning", section + ".convolver.partitioning");
+
+  update_key<double>(root, settings, "tail-threshold", section + ".convolver.tail-threshold");
 }
 
 void ConvolverPreset::write(PresetType preset_type, boost::property_tree::ptree& root) {
@@ -18,6 +18,44 @@
  */
 
 #include "convolver_ui.hpp"
+#include <cstring>
+
+namespace {
+
+auto partitioning_enum_to_int(GValue* value, GVariant* variant, gpointer user_data) -> gboolean {
+  const auto* v = g_variant_get_string(variant, nullptr);
+
+  if (std::strcmp(v, "min-latency") == 0) {
+    g_value_set_int(value, 0);
+  } else if (std::strcmp(v, "balanced") == 0) {
+    g_value_set_int(value, 1);
+  } else if (std::strcmp(v, "min-cpu") == 0) {
+    g_value_set_int(value, 2);
+  }
+
+  return 1;
+}
+
+auto int_to_partitioning_enum(const GValue* value, const GVariantType* expected_type, gpointer user_data)
+    -> GVariant* {
+  const auto v = g_value_get_int(value);
+
+  switch (v) {
+    case 0:
+      return g_variant_new_string("min-latency");
+
+    case 1:
+      return g_variant_new_string("balanced");
+
+    case 2:
+      return g_variant_new_string("min-cpu");
+
+    default:
+      return g_variant_new_string("balanced");
+  }
+}
+
+}  // namespace
 
 ConvolverUi::ConvolverUi(BaseObjectType* cobject,
                          const Glib::RefPtr<Gtk::Builder>& builder,
@@ -41,12 +79,16 @@ ConvolverUi::ConvolverUi(BaseObjectType* cobject,
   builder->get_widget("sampling_rate", label_sampling_rate);
   builder->get_widget("samples", label_samples);
   builder->get_widget("duration", label_duration);
+  builder->get_widget("effective_length", label_effective_length);
+  builder->get_widget("cpu_saving", label_cpu_saving);
   builder->get_widget("show_fft", show_fft);
   builder->get_widget("plugin_reset", reset_button);
+  builder->get_widget("partitioning", partitioning);
 
   get_object(builder, "input_gain", input_gain);
   get_object(builder, "output_gain", output_gain);
   get_object(builder, "ir_width", ir_width);
+  get_object(builder, "tail_threshold", tail_threshold);
 
   font.set_family("Monospace");
   font.set_weight(Pango::WEIGHT_BOLD);
@@ -87,6 +129,11 @@ ConvolverUi::ConvolverUi(BaseObjectType* cobject,
   settings->bind("input-gain", input_gain.get(), "value", flag);
   settings->bind("output-gain", output_gain.get(), "value", flag);
   settings->bind("ir-width", ir_width.get(), "value", flag);
+  settings->bind("tail-threshold", tail_threshold.get(), "value", flag);
+
+  g_settings_bind_with_mapping(settings->gobj(), "partitioning", partitioning->gobj(), "active",
+                               G_SETTINGS_BIND_DEFAULT, partitioning_enum_to_int, int_to_partitioning_enum, nullptr,
+                               nullptr);
 
   settings->set_boolean("post-messages", true);
 
@@ -107,35 +154,37 @@ ConvolverUi::ConvolverUi(BaseObjectType* cobject,
     util::debug(log_tag + "irs directory already exists: " + irs_dir.string());
   }
 
-  // reading current configured irs file
+  /*
+    impulse response analysis. The analyzer thread only wakes up the dispatcher. The results are taken and applied in
+    this thread. The analyzer is destroyed before the dispatcher, so no result arrives after we are gone.
+  */
+
+  analysis_dispatcher.connect([=]() {
+    if (irs_analyzer != nullptr) {
+      for (const auto& [path, analysis] : irs_analyzer->take_results()) {
+        apply_irs_analysis(path, analysis);
+      }
+    }
+  });
 
-  auto f = [=]() {
-    std::lock_guard<std::mutex> lock(lock_guard_irs_info);
-    get_irs_info();
-  };
+  irs_analyzer = std::make_unique<IrsAnalyzer>(max_plot_points, [=]() { analysis_dispatcher.emit(); });
 
-  auto future = std::async(std::launch::async, f);
+  // reading current configured irs file
 
-  futures.emplace_back(std::move(future));
+  show_irs_info(settings->get_string("kernel-path"));
 
   /* this is necessary to update the interface with the irs info when a preset
      is loaded
   */
 
-  connections.emplace_back(settings->signal_changed("kernel-path").connect([=](auto key) {
-    auto f = [=]() {
-      std::lock_guard<std::mutex> lock(lock_guard_irs_info);
-      get_irs_info();
-    };
-
-    auto future = std::async(std::launch::async, f);
+  connections.emplace_back(settings->signal_changed("kernel-path").connect(
+      [=](auto key) { show_irs_info(settings->get_string("kernel-path")); }));
 
-    futures.emplace_back(std::move(future));
-  }));
+  connections.emplace_back(settings->signal_changed("tail-threshold").connect([=](auto key) { update_tail_info(); }));
 }
 
 ConvolverUi::~ConvolverUi() {
-  futures.clear();
+  irs_analyzer = nullptr;
 
   util::debug(name + " ui destroyed");
 }
@@ -150,6 +199,10 @@ void ConvolverUi::reset() {
   settings->reset("kernel-path");
 
   settings->reset("ir-width");
+
+  settings->reset("partitioning");
+
+  settings->reset("tail-threshold");
 }
 
 auto ConvolverUi::get_irs_names() -> std::vector<std::string> {
@@ -175,8 +228,8 @@ void ConvolverUi::import_irs_file(const std::string& file_path) {
   if (boost::filesystem::is_regular_file(p)) {
     SndfileHandle file = SndfileHandle(file_path);
 
-    if (file.channels() != 2 || file.frames() == 0) {
-      util::warning(log_tag + " Only stereo impulse files are supported!");
+    if ((file.channels() != 1 && file.channels() != 2 && file.channels() != 4) || file.frames() == 0) {
+      util::warning(log_tag + " Only mono, stereo and true stereo impulse files are supported!");
       util::warning(log_tag + file_path + " loading failed");
 
       return;
@@ -248,6 +301,16 @@ void ConvolverUi::populate_irs_listbox() {
     row->set_name(name);
     label->set_text(name);
 
+    // the description is shown as soon as the analyzer has it
+
+    auto irs_file = irs_dir / boost::filesystem::path{name + ".irs"};
+
+    if (auto analysis = irs_analyzer->lookup(irs_file.string()); analysis != nullptr) {
+      row->set_tooltip_text(get_irs_description(*analysis));
+    } else {
+      irs_analyzer->request(irs_file.string(), false);
+    }
+
     connections.emplace_back(remove_btn->signal_clicked().connect([=]() {
       remove_irs_file(name);
       populate_irs_listbox();
@@ -306,224 +369,112 @@ void ConvolverUi::on_import_irs_clicked() {
   dialog->show();
 }
 
-void ConvolverUi::get_irs_info() {
-  auto path = settings->get_string("kernel-path");
-
-  SndfileHandle file = SndfileHandle(path);
-
-  if (file.channels() != 2 || file.frames() == 0) {
-    // warning user that there is a problem
-
-    Glib::signal_idle().connect_once([=]() {
-      label_sampling_rate->set_text(_("Failed"));
-      label_samples->set_text(_("Failed"));
-
-      label_duration->set_text(_("Failed"));
-
-      label_file_name->set_text(_("Could Not Load The Impulse File"));
-    });
+void ConvolverUi::show_irs_info(const std::string& path) {
+  auto analysis = irs_analyzer->lookup(path);
 
-    return;
-  }
-
-  uint frames_in = file.frames();
-  uint total_frames_in = file.channels() * frames_in;
-  uint rate = file.samplerate();
-
-  std::vector<float> kernel(total_frames_in);
-
-  file.readf(kernel.data(), frames_in);
-
-  // build plot time axis
-
-  float dt = 1.0F / rate;
-  float duration = (static_cast<float>(frames_in) - 1.0F) * dt;
-  uint max_points = (frames_in > max_plot_points) ? max_plot_points : frames_in;
-  float plot_dt = duration / max_points;
-
-  time_axis.resize(max_points);
-  time_axis.shrink_to_fit();
-
-  for (uint n = 0U; n < max_points; n++) {
-    time_axis[n] = n * plot_dt;
+  if (analysis != nullptr) {
+    apply_irs_analysis(path, analysis);
+  } else {
+    irs_analyzer->request(path, true);
   }
+}
 
-  max_time = *std::max_element(time_axis.begin(), time_axis.end());
-
-  // deinterleaving channels
-
-  left_mag.resize(frames_in);
-  right_mag.resize(frames_in);
+auto ConvolverUi::get_irs_description(const IrsAnalysis& analysis) -> std::string {
+  return std::to_string(analysis.rate) + " Hz, " + std::to_string(analysis.channels) + " ch, " +
+         level_to_localized_string(analysis.duration, 3) + " s";
+}
 
-  // ensure that the fft can be computed
+void ConvolverUi::apply_irs_analysis(const std::string& path, const std::shared_ptr<const IrsAnalysis>& analysis) {
+  auto fpath = boost::filesystem::path{path};
 
-  if (left_mag.size() % 2U != 0U) {
-    left_mag.emplace_back(0.0F);
-  }
+  // updating the rows of the listbox that are waiting for this file
 
-  if (right_mag.size() % 2U != 0U) {
-    right_mag.emplace_back(0.0F);
+  if (analysis != nullptr && fpath.parent_path() == irs_dir) {
+    for (auto* child : irs_listbox->get_children()) {
+      if (child->get_name() == fpath.stem().string()) {
+        child->set_tooltip_text(get_irs_description(*analysis));
+      }
+    }
   }
 
-  left_mag.shrink_to_fit();
-  right_mag.shrink_to_fit();
-
-  for (uint n = 0U; n < frames_in; n++) {
-    left_mag[n] = kernel[2U * n];
-    right_mag[n] = kernel[2U * n + 1U];
+  if (path != settings->get_string("kernel-path")) {
+    return;
   }
 
-  get_irs_spectrum(rate);
+  if (analysis == nullptr) {
+    // warning user that there is a problem
 
-  /*interpolating because we can not plot all the data in the irs file. It
-    would be too slow
-  */
+    label_sampling_rate->set_text(_("Failed"));
+    label_samples->set_text(_("Failed"));
 
-  try {
-    boost::math::interpolators::cardinal_cubic_b_spline<float> spline_L(left_mag.begin(), left_mag.end(), 0.0F, dt);
+    label_duration->set_text(_("Failed"));
 
-    boost::math::interpolators::cardinal_cubic_b_spline<float> spline_R(right_mag.begin(), right_mag.end(), 0.0F, dt);
+    label_effective_length->set_text(_("Failed"));
 
-    left_mag.resize(max_points);
-    right_mag.resize(max_points);
+    label_cpu_saving->set_text(_("Failed"));
 
-    left_mag.shrink_to_fit();
-    right_mag.shrink_to_fit();
+    label_file_name->set_text(_("Could Not Load The Impulse File"));
 
-    for (uint n = 0U; n < max_points; n++) {
-      left_mag[n] = spline_L(time_axis[n]);
-      right_mag[n] = spline_R(time_axis[n]);
-    }
-  } catch (const std::exception& e) {
-    util::debug(std::string("Message from thrown exception was: ") + e.what());
+    return;
   }
 
-  // find min and max values
-
-  min_left = *std::min_element(left_mag.begin(), left_mag.end());
-  max_left = *std::max_element(left_mag.begin(), left_mag.end());
-  min_right = *std::min_element(right_mag.begin(), right_mag.end());
-  max_right = *std::max_element(right_mag.begin(), right_mag.end());
-
-  // rescaling between 0 and 1
-
-  for (uint n = 0U; n < max_points; n++) {
-    left_mag[n] = (left_mag[n] - min_left) / (max_left - min_left);
-    right_mag[n] = (right_mag[n] - min_right) / (max_right - min_right);
-  }
+  time_axis = analysis->time_axis;
+  left_mag = analysis->left_mag;
+  right_mag = analysis->right_mag;
+  min_left = analysis->min_left;
+  max_left = analysis->max_left;
+  min_right = analysis->min_right;
+  max_right = analysis->max_right;
+  max_time = analysis->duration;
+
+  freq_axis = analysis->freq_axis;
+  left_spectrum = analysis->left_spectrum;
+  right_spectrum = analysis->right_spectrum;
+  fft_min_left = analysis->fft_min_left;
+  fft_max_left = analysis->fft_max_left;
+  fft_min_right = analysis->fft_min_right;
+  fft_max_right = analysis->fft_max_right;
+  fft_min_freq = analysis->fft_min_freq;
+  fft_max_freq = analysis->fft_max_freq;
+
+  edc = analysis->edc;
 
   // updating interface with ir file info
 
-  Glib::signal_idle().connect_once([=]() {
-    label_sampling_rate->set_text(std::to_string(rate) + " Hz");
-    label_samples->set_text(std::to_string(frames_in));
+  label_sampling_rate->set_text(std::to_string(analysis->rate) + " Hz");
+  label_samples->set_text(std::to_string(analysis->frames));
 
-    label_duration->set_text(level_to_localized_string(duration, 3) + " s");
+  label_duration->set_text(level_to_localized_string(analysis->duration, 3) + " s");
 
-    auto fpath = boost::filesystem::path{path};
+  label_file_name->set_text(fpath.stem().string());
 
-    label_file_name->set_text(fpath.stem().string());
+  update_tail_info();
 
-    left_plot->queue_draw();
-    right_plot->queue_draw();
-  });
+  left_plot->queue_draw();
+  right_plot->queue_draw();
 }
 
-void ConvolverUi::get_irs_spectrum(const int& rate) {
-  uint nfft = left_mag.size();  // right_mag.size() should have the same value
-
-  GstFFTF32* fft_ctx = gst_fft_f32_new(nfft, 0);
-  auto* freqdata_l = g_new0(GstFFTF32Complex, nfft / 2U + 1U);
-  auto* freqdata_r = g_new0(GstFFTF32Complex, nfft / 2U + 1U);
-
-  std::vector<float> tmp_l;
-  std::vector<float> tmp_r;
-
-  tmp_l.resize(nfft);
-  tmp_r.resize(nfft);
-
-  tmp_l.shrink_to_fit();
-  tmp_r.shrink_to_fit();
-
-  std::copy(left_mag.begin(), left_mag.end(), tmp_l.begin());
-  std::copy(right_mag.begin(), right_mag.end(), tmp_r.begin());
-
-  gst_fft_f32_fft(fft_ctx, tmp_l.data(), freqdata_l);
-  gst_fft_f32_fft(fft_ctx, tmp_r.data(), freqdata_r);
-
-  left_spectrum.resize(nfft / 2U + 1U);
-  right_spectrum.resize(nfft / 2U + 1U);
-
-  for (uint i = 0U; i < nfft / 2U + 1U; i++) {
-    float v_l = 0.0F;
-    float v_r = 0.0F;
-
-    // left
-    v_l = freqdata_l[i].r * freqdata_l[i].r;
-    v_l += freqdata_l[i].i * freqdata_l[i].i;
-    v_l = std::sqrt(v_l);
-
-    left_spectrum[i] = v_l;
-
-    // right
-    v_r = freqdata_r[i].r * freqdata_r[i].r;
-    v_r += freqdata_r[i].i * freqdata_r[i].i;
-    v_r = std::sqrt(v_r);
+/*
+  The convolver cuts the kernel where its energy decay curve crosses the tail threshold. The cost of the
+  partitioned convolution grows with the number of partitions, so the saving is proportional to the trimmed length.
+*/
 
-    right_spectrum[i] = v_r;
+void ConvolverUi::update_tail_info() {
+  if (edc.empty()) {
+    return;
   }
 
-  uint max_points = std::min(static_cast<uint>(left_spectrum.size()), max_plot_points);
-
-  fft_min_freq = 1.0F;
-  fft_max_freq = 0.5F * static_cast<float>(rate);
-
-  freq_axis = util::logspace(log10(fft_min_freq), log10(fft_max_freq), max_points);
-
-  /*interpolating because we can not plot all the data in the irs file. It
-    would be too slow
-  */
-
-  try {
-    float dF = 0.5F * static_cast<float>(rate) / left_spectrum.size();
-
-    boost::math::interpolators::cardinal_cubic_b_spline<float> spline_L(left_spectrum.begin(), left_spectrum.end(),
-                                                                        0.0F, dF);
-
-    boost::math::interpolators::cardinal_cubic_b_spline<float> spline_R(right_spectrum.begin(), right_spectrum.end(),
-                                                                        0.0F, dF);
-
-    left_spectrum.resize(max_points);
-    right_spectrum.resize(max_points);
-
-    left_spectrum.shrink_to_fit();
-    right_spectrum.shrink_to_fit();
+  auto threshold = static_cast<float>(settings->get_double("tail-threshold"));
 
-    for (uint n = 0U; n < max_points; n++) {
-      left_spectrum[n] = spline_L(freq_axis[n]);
-      right_spectrum[n] = spline_R(freq_axis[n]);
-    }
-  } catch (const std::exception& e) {
-    util::debug(std::string("Message from thrown exception was: ") + e.what());
-  }
-
-  // find min and max values
+  auto it = std::find_if(edc.begin(), edc.end(), [=](auto v) { return v < threshold; });
 
-  fft_min_left = *std::min_element(left_spectrum.begin(), left_spectrum.end());
-  fft_max_left = *std::max_element(left_spectrum.begin(), left_spectrum.end());
-  fft_min_right = *std::min_element(right_spectrum.begin(), right_spectrum.end());
-  fft_max_right = *std::max_element(right_spectrum.begin(), right_spectrum.end());
+  float effective_length = max_time * static_cast<float>(it - edc.begin()) / static_cast<float>(edc.size());
 
-  // rescaling between 0 and 1
+  float saving = (max_time > 0.0F) ? 100.0F * (1.0F - effective_length / max_time) : 0.0F;
 
-  for (unsigned int n = 0U; n < left_spectrum.size(); n++) {
-    left_spectrum[n] = (left_spectrum[n] - fft_min_left) / (fft_max_left - fft_min_left);
-    right_spectrum[n] = (right_spectrum[n] - fft_min_right) / (fft_max_right - fft_min_right);
-  }
+  label_effective_length->set_text(level_to_localized_string(effective_length, 3) + " s");
 
-  gst_fft_f32_free(fft_ctx);
-  g_free(freqdata_l);
-  g_free(freqdata_r);
+  label_cpu_saving->set_text(level_to_localized_string(saving, 0) + " %");
 }
 
 void ConvolverUi::draw_channel(Gtk::DrawingArea* da,
@@ -636,8 +587,6 @@ void ConvolverUi::update_mouse_info_R(GdkEventMotion* event) {
 }
 
 auto ConvolverUi::on_left_draw(const Cairo::RefPtr<Cairo::Context>& ctx) -> bool {
-  std::lock_guard<std::mutex> lock(lock_guard_irs_info);
-
   ctx->paint();
 
   if (show_fft_spectrum) {
@@ -658,8 +607,6 @@ auto ConvolverUi::on_left_motion_notify_event(GdkEventMotion* event) -> bool {
 }
 
 auto ConvolverUi::on_right_draw(const Cairo::RefPtr<Cairo::Context>& ctx) -> bool {
-  std::lock_guard<std::mutex> lock(lock_guard_irs_info);
-
   ctx->paint();
 
   if (show_fft_spectrum) {
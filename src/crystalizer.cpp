@@ -60,6 +60,21 @@ void on_post_messages_changed(GSettings* settings, gchar* key, Crystalizer* l) {
   }
 }
 
+/*
+  A preset load changes the 39 band keys one after the other. They are all sent to the crystalizer in a single update
+  when the main loop becomes idle.
+*/
+
+void on_band_changed(GSettings* settings, gchar* key, Crystalizer* c) {
+  if (!c->bands_connection.connected()) {
+    c->bands_connection = Glib::signal_idle().connect([c]() {
+      c->update_bands();
+
+      return false;
+    });
+  }
+}
+
 void on_n_input_samples_changed(GObject* gobject, GParamSpec* pspec, Crystalizer* c) {
   int v = 0;
   int blocksize = 0;
@@ -129,23 +144,40 @@ Crystalizer::Crystalizer(const std::string& tag, const std::string& schema, cons
 }
 
 Crystalizer::~Crystalizer() {
+  bands_connection.disconnect();
+
   util::debug(log_tag + name + " destroyed");
 }
 
+void Crystalizer::update_bands() {
+  GVariantBuilder builder;
+
+  g_variant_builder_init(&builder, G_VARIANT_TYPE("a(dbb)"));
+
+  for (int n = 0; n < 13; n++) {
+    auto intensity = g_settings_get_double(settings, std::string("intensity-band" + std::to_string(n)).c_str());
+    auto mute = g_settings_get_boolean(settings, std::string("mute-band" + std::to_string(n)).c_str());
+    auto bypass = g_settings_get_boolean(settings, std::string("bypass-band" + std::to_string(n)).c_str());
+
+    g_variant_builder_add(&builder, "(dbb)", util::db_to_linear(intensity), mute, bypass);
+  }
+
+  g_object_set(crystalizer, "bands", g_variant_builder_end(&builder), nullptr);
+}
+
 void Crystalizer::bind_to_gsettings() {
   g_settings_bind(settings, "post-messages", crystalizer, "notify-host", G_SETTINGS_BIND_DEFAULT);
 
   g_settings_bind(settings, "aggressive", crystalizer, "aggressive", G_SETTINGS_BIND_DEFAULT);
 
-  for (int n = 0; n < 13; n++) {
-    g_settings_bind_with_mapping(settings, std::string("intensity-band" + std::to_string(n)).c_str(), crystalizer,
-                                 std::string("intensity-band" + std::to_string(n)).c_str(), G_SETTINGS_BIND_GET,
-                                 util::db20_gain_to_linear, nullptr, nullptr, nullptr);
-
-    g_settings_bind(settings, std::string("mute-band" + std::to_string(n)).c_str(), crystalizer,
-                    std::string("mute-band" + std::to_string(n)).c_str(), G_SETTINGS_BIND_DEFAULT);
+  g_settings_bind(settings, "crossover", crystalizer, "crossover", G_SETTINGS_BIND_DEFAULT);
 
-    g_settings_bind(settings, std::string("bypass-band" + std::to_string(n)).c_str(), crystalizer,
-                    std::string("bypass-band" + std::to_string(n)).c_str(), G_SETTINGS_BIND_DEFAULT);
+  for (int n = 0; n < 13; n++) {
+    for (const auto& key : {"intensity-band", "mute-band", "bypass-band"}) {
+      g_signal_connect(settings, std::string("changed::" + std::string(key) + std::to_string(n)).c_str(),
+                       G_CALLBACK(on_band_changed), this);
+    }
   }
+
+  update_bands();
 }
@@ -0,0 +1,78 @@
+/*
+ *  Copyright © 2017-2020 Wellington Wallace
+ *
+ *  This file is part of PulseEffects.
+ *
+ *  PulseEffects is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  PulseEffects is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with PulseEffects.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef BAND_CACHE_HPP
+#define BAND_CACHE_HPP
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/*
+  Designing the band kernels takes a few ffts per band. The result only depends on the sampling rate, the split
+  frequencies and the kind of filter. So the kernels are kept in memory for all the crystalizer instances in the
+  process. A pipeline restart at a rate that was already seen does not design anything.
+*/
+
+namespace band_cache {
+
+constexpr size_t max_entries = 8U;
+
+inline auto mutex() -> std::mutex& {
+  static std::mutex m;
+
+  return m;
+}
+
+inline auto entries() -> std::map<std::string, std::vector<std::vector<float>>>& {
+  static std::map<std::string, std::vector<std::vector<float>>> e;
+
+  return e;
+}
+
+inline auto load(const std::string& key, std::vector<std::vector<float>>& kernels) -> bool {
+  std::lock_guard<std::mutex> lock(mutex());
+
+  auto it = entries().find(key);
+
+  if (it == entries().end()) {
+    return false;
+  }
+
+  kernels = it->second;
+
+  return true;
+}
+
+inline void store(const std::string& key, const std::vector<std::vector<float>>& kernels) {
+  std::lock_guard<std::mutex> lock(mutex());
+
+  // a handful of rates and layouts is all we expect to see
+
+  if (entries().size() >= max_entries) {
+    entries().clear();
+  }
+
+  entries()[key] = kernels;
+}
+
+}  // namespace band_cache
+
+#endif
@@ -0,0 +1,201 @@
+/*
+ *  Copyright © 2017-2020 Wellington Wallace
+ *
+ *  This file is part of PulseEffects.
+ *
+ *  PulseEffects is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  PulseEffects is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with PulseEffects.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "crossover.hpp"
+#include <boost/math/constants/constants.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace {
+
+const float PI = boost::math::constants::pi<float>();
+
+}  // namespace
+
+/*
+  Coefficients from the Audio EQ Cookbook with the butterworth Q. Two cascaded butterworth sections make a
+  Linkwitz-Riley filter and the sum of its lowpass and highpass outputs is the allpass with this same Q.
+*/
+
+void Biquad::create(const Type& type, const float& rate, const float& freq) {
+  const float Q = 1.0F / std::sqrt(2.0F);
+
+  float w0 = 2.0F * PI * freq / rate;
+  float cosw = std::cos(w0);
+  float alpha = std::sin(w0) / (2.0F * Q);
+  float a0 = 1.0F + alpha;
+
+  switch (type) {
+    case lowpass:
+      b0 = 0.5F * (1.0F - cosw) / a0;
+      b1 = (1.0F - cosw) / a0;
+      b2 = b0;
+      break;
+    case highpass:
+      b0 = 0.5F * (1.0F + cosw) / a0;
+      b1 = -(1.0F + cosw) / a0;
+      b2 = b0;
+      break;
+    case allpass:
+      b0 = (1.0F - alpha) / a0;
+      b1 = -2.0F * cosw / a0;
+      b2 = 1.0F;
+      break;
+  }
+
+  a1 = -2.0F * cosw / a0;
+  a2 = (1.0F - alpha) / a0;
+
+  reset();
+}
+
+void Biquad::reset() {
+  z1 = stereo_t{0.0F, 0.0F};
+  z2 = stereo_t{0.0F, 0.0F};
+}
+
+void Biquad::process(float* data, const uint& nsamples) {
+  stereo_t s1 = z1, s2 = z2;
+
+  for (uint n = 0U; n < nsamples; n++) {
+    stereo_t x = {data[2U * n], data[2U * n + 1U]};
+
+    stereo_t y = b0 * x + s1;
+
+    s1 = b1 * x - a1 * y + s2;
+    s2 = b2 * x - a2 * y;
+
+    data[2U * n] = y[0];
+    data[2U * n + 1U] = y[1];
+  }
+
+  z1 = s1;
+  z2 = s2;
+}
+
+Crossover::Crossover(const std::string& tag) : log_tag(tag) {}
+
+void Crossover::create(const float& rate, const std::vector<float>& freqs) {
+  finish();
+
+  nsplits = freqs.size();
+
+  lowpass.resize(2U * nsplits);
+  highpass.resize(2U * nsplits);
+  allpass.resize(nsplits + 1U);
+
+  for (uint n = 0U; n < nsplits; n++) {
+    // a split frequency too close to nyquist would give an unstable filter
+
+    float f = std::min(freqs[n], 0.45F * rate);
+
+    for (uint m = 0U; m < 2U; m++) {
+      lowpass[2U * n + m].create(Biquad::lowpass, rate, f);
+      highpass[2U * n + m].create(Biquad::highpass, rate, f);
+    }
+  }
+
+  // the band n goes through the allpass of the splits above it
+
+  for (uint n = 0U; n < nsplits + 1U; n++) {
+    allpass[n].clear();
+
+    for (uint m = n + 1U; m < nsplits; m++) {
+      Biquad ap;
+
+      ap.create(Biquad::allpass, rate, std::min(freqs[m], 0.45F * rate));
+
+      allpass[n].emplace_back(ap);
+    }
+  }
+
+  last_skip_mask = 0U;
+
+  ready = true;
+
+  util::debug(log_tag + "linkwitz-riley crossover with " + std::to_string(nsplits + 1U) + " bands");
+}
+
+void Crossover::process(const float* data,
+                        const uint& nsamples,
+                        std::vector<std::vector<float>>& output,
+                        const uint32_t& skip_mask) {
+  if (!ready) {
+    return;
+  }
+
+  remainder.resize(2U * nsamples);
+
+  std::memcpy(remainder.data(), data, 2U * nsamples * sizeof(float));
+
+  band.resize(2U * nsamples);
+
+  // the filters of a band that was skipped kept an old state. Resuming from it would cause a transient
+
+  uint32_t resumed = last_skip_mask & ~skip_mask;
+
+  last_skip_mask = skip_mask;
+
+  for (uint n = 0U; n < nsplits; n++) {
+    bool skip = (skip_mask & (1U << n)) != 0U;
+
+    if ((resumed & (1U << n)) != 0U) {
+      lowpass[2U * n].reset();
+      lowpass[2U * n + 1U].reset();
+
+      for (auto& ap : allpass[n]) {
+        ap.reset();
+      }
+    }
+
+    if (!skip) {
+      std::memcpy(band.data(), remainder.data(), 2U * nsamples * sizeof(float));
+
+      lowpass[2U * n].process(band.data(), nsamples);
+      lowpass[2U * n + 1U].process(band.data(), nsamples);
+    }
+
+    highpass[2U * n].process(remainder.data(), nsamples);
+    highpass[2U * n + 1U].process(remainder.data(), nsamples);
+
+    if (!skip) {
+      for (auto& ap : allpass[n]) {
+        ap.process(band.data(), nsamples);
+      }
+
+      deinterleave(band.data(), nsamples, output[n].data());
+    }
+  }
+
+  if ((skip_mask & (1U << nsplits)) == 0U) {
+    deinterleave(remainder.data(), nsamples, output[nsplits].data());
+  }
+}
+
+void Crossover::deinterleave(const float* data, const uint& nsamples, float* output) {
+  for (uint n = 0U; n < nsamples; n++) {
+    output[n] = data[2U * n];
+    output[nsamples + n] = data[2U * n + 1U];
+  }
+}
+
+void Crossover::finish() {
+  ready = false;
+}
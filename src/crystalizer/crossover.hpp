@@ -0,0 +1,97 @@
+/*
+ *  Copyright © 2017-2020 Wellington Wallace
+ *
+ *  This file is part of PulseEffects.
+ *
+ *  PulseEffects is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  PulseEffects is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with PulseEffects.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef CROSSOVER_HPP
+#define CROSSOVER_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "util.hpp"
+
+// left and right channels are filtered together in the two lanes of a vector register
+
+typedef float stereo_t __attribute__((vector_size(8)));
+
+// transposed direct form II biquad
+
+struct Biquad {
+  float b0 = 1.0F, b1 = 0.0F, b2 = 0.0F, a1 = 0.0F, a2 = 0.0F;
+
+  stereo_t z1 = {0.0F, 0.0F}, z2 = {0.0F, 0.0F};
+
+  enum Type { lowpass, highpass, allpass };
+
+  void create(const Type& type, const float& rate, const float& freq);
+
+  void reset();
+
+  // data has nsamples interleaved stereo frames
+
+  void process(float* data, const uint& nsamples);
+};
+
+/*
+  Splits the signal in bands with cascaded 4th order Linkwitz-Riley crossovers. The lowpass and highpass outputs of
+  a Linkwitz-Riley crossover add up to an allpass. So every band also goes through the allpass of the crossovers
+  above it. This way all the bands have the same phase response and their sum is flat. There is no latency.
+*/
+
+class Crossover {
+ public:
+  Crossover(const std::string& tag);
+
+  bool ready = false;
+
+  // freqs are the split frequencies in ascending order. There is one band more than frequencies
+
+  void create(const float& rate, const std::vector<float>& freqs);
+
+  /*
+    Filters nsamples interleaved stereo frames. The output of band n is written planar to output[n]: the left
+    channel followed by the right one. The lowpass and the allpass filters of the bands in skip_mask are not run.
+    Their highpass is still needed by the bands above them. When a band leaves skip_mask its filters start from
+    silence instead of the state they had when it was skipped.
+  */
+
+  void process(const float* data,
+               const uint& nsamples,
+               std::vector<std::vector<float>>& output,
+               const uint32_t& skip_mask);
+
+  void finish();
+
+ private:
+  std::string log_tag;
+
+  uint nsplits = 0U;
+
+  uint32_t last_skip_mask = 0U;  // skip_mask of the previous call
+
+  std::vector<Biquad> lowpass, highpass;  // two cascaded butterworth sections for each split
+
+  std::vector<std::vector<Biquad>> allpass;  // allpass[n] has the phase compensation of band n
+
+  std::vector<float> remainder;  // what is above the last split done
+  std::vector<float> band;       // interleaved output of the band being split
+
+  static void deinterleave(const float* data, const uint& nsamples, float* output);
+};
+
+#endif
@@ -18,21 +18,18 @@
  */
 
 #include "filter.hpp"
+#include <fftw3.h>
 #include <boost/math/constants/constants.hpp>
 #include <boost/math/special_functions/sinc.hpp>
-
-#define CONVPROC_SCHEDULER_PRIORITY 0
-#define CONVPROC_SCHEDULER_CLASS SCHED_FIFO
-#define THREAD_SYNC_MODE true
+#include <algorithm>
+#include <cmath>
 
 const float PI = boost::math::constants::pi<float>();
 
 Filter::Filter(const std::string& tag) : log_tag(tag) {}
 
 Filter::~Filter() {
-  util::warning(log_tag + " destructed");
-
-  finish();
+  util::debug(log_tag + " destructed");
 }
 
 void Filter::create_lowpass_kernel(const float& rate, const float& cutoff, const float& transition_band) {
@@ -93,143 +90,169 @@ void Filter::create_bandpass_kernel(const float& rate,
 
   kernel.resize(kernel_size);
 
-  direct_conv(lowpass_kernel, highpass_kernel, kernel);
+  fft_conv(lowpass_kernel, highpass_kernel, kernel);
 }
 
-void Filter::direct_conv(const std::vector<float>& a, const std::vector<float>& b, std::vector<float>& c) {
-  uint M = (c.size() + 1U) / 2U;
+/*
+  Linear convolution through the product of the spectra. The fft is long enough for the whole result so that there is
+  no circular wrap around.
+*/
+
+void Filter::fft_conv(const std::vector<float>& a, const std::vector<float>& b, std::vector<float>& c) {
+  uint fft_size = 1U;
 
-  for (uint n = 0U; n < c.size(); n++) {
-    c[n] = 0.0F;
+  while (fft_size < a.size() + b.size() - 1U) {
+    fft_size *= 2U;
+  }
 
-    for (uint m = 0U; m < M; m++) {
-      if (n > m && n - m < M) {
-        c[n] += a[n - m] * b[m];
-      }
-    }
+  uint nbins = fft_size / 2U + 1U;
+
+  auto* time_data = fftwf_alloc_real(fft_size);
+  auto* freq_a = fftwf_alloc_complex(nbins);
+  auto* freq_b = fftwf_alloc_complex(nbins);
+
+  fftwf_plan forward_a = nullptr, forward_b = nullptr, backward = nullptr;
+
+  forward_a = fftwf_plan_dft_r2c_1d(fft_size, time_data, freq_a, FFTW_ESTIMATE);
+  forward_b = fftwf_plan_dft_r2c_1d(fft_size, time_data, freq_b, FFTW_ESTIMATE);
+  backward = fftwf_plan_dft_c2r_1d(fft_size, freq_a, time_data, FFTW_ESTIMATE);
+
+  std::fill(time_data, time_data + fft_size, 0.0F);
+  std::copy(a.begin(), a.end(), time_data);
+
+  fftwf_execute(forward_a);
+
+  std::fill(time_data, time_data + fft_size, 0.0F);
+  std::copy(b.begin(), b.end(), time_data);
+
+  fftwf_execute(forward_b);
+
+  // fftw does not normalize. The scale goes with the product
+
+  float scale = 1.0F / static_cast<float>(fft_size);
+
+  for (uint k = 0U; k < nbins; k++) {
+    float re = freq_a[k][0] * freq_b[k][0] - freq_a[k][1] * freq_b[k][1];
+    float im = freq_a[k][0] * freq_b[k][1] + freq_a[k][1] * freq_b[k][0];
+
+    freq_a[k][0] = re * scale;
+    freq_a[k][1] = im * scale;
   }
+
+  fftwf_execute(backward);
+
+  std::copy(time_data, time_data + c.size(), c.begin());
+
+  fftwf_destroy_plan(forward_a);
+  fftwf_destroy_plan(forward_b);
+  fftwf_destroy_plan(backward);
+
+  fftwf_free(time_data);
+  fftwf_free(freq_a);
+  fftwf_free(freq_b);
 }
 
-void Filter::create_lowpass(const int& nsamples, const float& rate, const float& cutoff, const float& transition_band) {
+void Filter::create_lowpass(const float& rate, const float& cutoff, const float& transition_band) {
   create_lowpass_kernel(rate, cutoff, transition_band);
 
   // util::debug(log_tag + " kernel size = " + std::to_string(kernel_size));
-
-  init_zita(nsamples);
 }
 
-void Filter::create_highpass(const int& nsamples,
-                             const float& rate,
-                             const float& cutoff,
-                             const float& transition_band) {
+void Filter::create_highpass(const float& rate, const float& cutoff, const float& transition_band) {
   create_highpass_kernel(rate, cutoff, transition_band);
 
   // util::debug(log_tag + " kernel size = " + std::to_string(kernel_size));
-
-  init_zita(nsamples);
 }
 
-void Filter::create_bandpass(const int& nsamples,
-                             const float& rate,
+void Filter::create_bandpass(const float& rate,
                              const float& cutoff1,
                              const float& cutoff2,
                              const float& transition_band) {
   create_bandpass_kernel(rate, cutoff1, cutoff2, transition_band);
 
   // util::debug(log_tag + " kernel size = " + std::to_string(kernel_size));
-
-  init_zita(nsamples);
 }
 
-void Filter::init_zita(const int& num_samples) {
-  bool failed = false;
-  float density = 0.0F;
-  int ret = 0;
-  unsigned int options = 0U;
-
-  nsamples = num_samples;
-
-  // depending on buffer and kernel size OPT_FFTW_MEASURE may make us crash
-  // options |= Convproc::OPT_FFTW_MEASURE;
-  options |= Convproc::OPT_VECTOR_MODE;
+/*
+  Homomorphic method. The real cepstrum of the kernel is folded so that it becomes causal. The exponential of its
+  transform has the magnitude response of the original kernel with all the zeros inside the unit circle. The fft is
+  much longer than the kernel to keep the aliasing of the cepstrum low.
+*/
+
+void Filter::make_minimum_phase() {
+  if (kernel.empty()) {
+    return;
+  }
 
-  conv = new Convproc();
+  uint fft_size = 1U;
 
-  conv->set_options(options);
+  while (fft_size < 8U * kernel.size()) {
+    fft_size *= 2U;
+  }
 
-#if ZITA_CONVOLVER_MAJOR_VERSION == 3
-  conv->set_density(density);
+  auto* data = fftwf_alloc_complex(fft_size);
 
-  ret = conv->configure(2, 2, kernel_size, nsamples, nsamples, Convproc::MAXPART);
-#endif
+  fftwf_plan forward = nullptr, backward = nullptr;
 
-#if ZITA_CONVOLVER_MAJOR_VERSION == 4
-  ret = conv->configure(2, 2, kernel_size, nsamples, nsamples, Convproc::MAXPART, density);
-#endif
+  forward = fftwf_plan_dft_1d(fft_size, data, data, FFTW_FORWARD, FFTW_ESTIMATE);
+  backward = fftwf_plan_dft_1d(fft_size, data, data, FFTW_BACKWARD, FFTW_ESTIMATE);
 
-  if (ret != 0) {
-    failed = true;
-    util::debug(log_tag + "can't initialise zita-convolver engine: " + std::to_string(ret));
+  for (uint n = 0U; n < fft_size; n++) {
+    data[n][0] = (n < kernel.size()) ? kernel[n] : 0.0F;
+    data[n][1] = 0.0F;
   }
 
-  ret = conv->impdata_create(0, 0, 1, kernel.data(), 0, kernel_size);
+  fftwf_execute(forward);
 
-  if (ret != 0) {
-    failed = true;
-    util::debug(log_tag + "left impdata_create failed: " + std::to_string(ret));
-  }
+  // log of the magnitude. The floor avoids log(0) deep in the stopband
 
-  ret = conv->impdata_create(1, 1, 1, kernel.data(), 0, kernel_size);
-
-  if (ret != 0) {
-    failed = true;
-    util::debug(log_tag + "right impdata_create failed: " + std::to_string(ret));
+  for (uint n = 0U; n < fft_size; n++) {
+    data[n][0] = std::log(std::max(std::hypot(data[n][0], data[n][1]), 1.0e-9F));
+    data[n][1] = 0.0F;
   }
 
-  ret = conv->start_process(CONVPROC_SCHEDULER_PRIORITY, CONVPROC_SCHEDULER_CLASS);
+  fftwf_execute(backward);
 
-  if (ret != 0) {
-    failed = true;
-    util::debug(log_tag + "start_process failed: " + std::to_string(ret));
-  }
+  // folding the cepstrum. fftw does not normalize so the backward transform is scaled here
 
-  ready = !failed;
-}
+  float scale = 1.0F / static_cast<float>(fft_size);
 
-void Filter::process(float* data) {
-  if (ready) {
-    // deinterleave
-    for (int n = 0; n < nsamples; n++) {
-      conv->inpdata(0)[n] = data[2 * n];
-      conv->inpdata(1)[n] = data[2 * n + 1];
+  for (uint n = 0U; n < fft_size; n++) {
+    if (n == 0U || n == fft_size / 2U) {
+      data[n][0] *= scale;
+    } else if (n < fft_size / 2U) {
+      data[n][0] *= 2.0F * scale;
+    } else {
+      data[n][0] = 0.0F;
     }
 
-    int ret = conv->process(THREAD_SYNC_MODE);
+    data[n][1] = 0.0F;
+  }
 
-    if (ret != 0) {
-      util::debug(log_tag + "IR: process failed: " + std::to_string(ret));
-    }
+  fftwf_execute(forward);
 
-    // interleave
-    for (int n = 0; n < nsamples; n++) {
-      data[2 * n] = conv->outdata(0)[n];
-      data[2 * n + 1] = conv->outdata(1)[n];
-    }
+  // complex exponential
+
+  for (uint n = 0U; n < fft_size; n++) {
+    float magnitude = std::exp(data[n][0]);
+    float phase = data[n][1];
+
+    data[n][0] = magnitude * std::cos(phase);
+    data[n][1] = magnitude * std::sin(phase);
   }
-}
 
-void Filter::finish() {
-  ready = false;
+  fftwf_execute(backward);
 
-  if (conv != nullptr) {
-    if (conv->state() != Convproc::ST_STOP) {
-      conv->stop_process();
+  for (uint n = 0U; n < kernel.size(); n++) {
+    kernel[n] = data[n][0] * scale;
+  }
 
-      conv->cleanup();
+  fftwf_destroy_plan(forward);
+  fftwf_destroy_plan(backward);
 
-      delete conv;
+  fftwf_free(data);
+}
 
-      conv = nullptr;
-    }
-  }
+auto Filter::get_kernel() const -> const std::vector<float>& {
+  return kernel;
 }
@@ -20,39 +20,40 @@
 #ifndef FILTER_HPP
 #define FILTER_HPP
 
-#include <zita-convolver.h>
+#include <vector>
 #include "util.hpp"
 
+/*
+  Designs the windowed sinc kernels of the crystalizer bands. The convolution itself is done by the Filterbank.
+*/
+
 class Filter {
  public:
   Filter(const std::string& tag);
 
   ~Filter();
 
-  bool ready = false;
+  void create_lowpass(const float& rate, const float& cutoff, const float& transition_band);
 
-  void create_lowpass(const int& nsamples, const float& rate, const float& cutoff, const float& transition_band);
+  void create_highpass(const float& rate, const float& cutoff, const float& transition_band);
 
-  void create_highpass(const int& nsamples, const float& rate, const float& cutoff, const float& transition_band);
+  void create_bandpass(const float& rate, const float& cutoff1, const float& cutoff2, const float& transition_band);
 
-  void create_bandpass(const int& nsamples,
-                       const float& rate,
-                       const float& cutoff1,
-                       const float& cutoff2,
-                       const float& transition_band);
+  /*
+    Converts the kernel to minimum phase. The magnitude response does not change but most of the delay of the linear
+    phase kernel goes away. Bands converted this way do not add up exactly flat around the split frequencies.
+  */
 
-  void process(float* data);
+  void make_minimum_phase();
 
-  void finish();
+  auto get_kernel() const -> const std::vector<float>&;
 
  private:
   std::string log_tag;
 
-  int kernel_size = 0, nsamples = 0;
+  int kernel_size = 0;
   std::vector<float> kernel;
 
-  Convproc* conv = nullptr;
-
   void create_lowpass_kernel(const float& rate, const float& cutoff, const float& transition_band);
 
   void create_highpass_kernel(const float& rate, const float& cutoff, const float& transition_band);
@@ -62,9 +63,9 @@ class Filter {
                               const float& cutoff2,
                               const float& transition_band);
 
-  void init_zita(const int& num_samples);
+  // c must have space for a.size() + b.size() - 1 samples
 
-  void direct_conv(const std::vector<float>& a, const std::vector<float>& b, std::vector<float>& c);
+  void fft_conv(const std::vector<float>& a, const std::vector<float>& b, std::vector<float>& c);
 };
 
 #endif
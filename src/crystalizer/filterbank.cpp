@@ -0,0 +1,260 @@
+/*
+ *  Copyright © 2017-2020 Wellington Wallace
+ *
+ *  This file is part of PulseEffects.
+ *
+ *  PulseEffects is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  PulseEffects is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with PulseEffects.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "filterbank.hpp"
+#include <algorithm>
+#include <cstring>
+
+Filterbank::Filterbank(const std::string& tag) : log_tag(tag) {}
+
+Filterbank::~Filterbank() {
+  finish();
+}
+
+void Filterbank::create(const uint& block_size, const std::vector<std::vector<float>>& kernels) {
+  finish();
+
+  if (block_size == 0U || kernels.empty()) {
+    return;
+  }
+
+  nsamples = block_size;
+  nbins = nsamples + 1U;
+  nbands = kernels.size();
+
+  size_t max_size = 0U;
+
+  for (auto& k : kernels) {
+    max_size = std::max(max_size, k.size());
+  }
+
+  npartitions = std::max(1U, static_cast<uint>((max_size + nsamples - 1U) / nsamples));
+
+  uint fft_size = 2U * nsamples;
+
+  time_data = fftwf_alloc_real(fft_size);
+  freq_data = fftwf_alloc_complex(nbins);
+
+  forward = fftwf_plan_dft_r2c_1d(fft_size, time_data, freq_data, FFTW_ESTIMATE);
+  backward = fftwf_plan_dft_c2r_1d(fft_size, freq_data, time_data, FFTW_ESTIMATE);
+
+  // fftw does not normalize. We do it once in the kernels
+
+  float scale = 1.0F / static_cast<float>(fft_size);
+
+  kernels_re.assign(nbands * npartitions * nbins, 0.0F);
+  kernels_im.assign(nbands * npartitions * nbins, 0.0F);
+
+  for (uint b = 0U; b < nbands; b++) {
+    for (uint p = 0U; p < npartitions; p++) {
+      std::fill(time_data, time_data + fft_size, 0.0F);
+
+      size_t start = std::min(static_cast<size_t>(p * nsamples), kernels[b].size());
+      size_t end = std::min(start + nsamples, kernels[b].size());
+
+      std::copy(kernels[b].begin() + start, kernels[b].begin() + end, time_data);
+
+      fftwf_execute(forward);
+
+      uint offset = (b * npartitions + p) * nbins;
+
+      for (uint k = 0U; k < nbins; k++) {
+        kernels_re[offset + k] = freq_data[k][0] * scale;
+        kernels_im[offset + k] = freq_data[k][1] * scale;
+      }
+    }
+  }
+
+  group_re.assign(npartitions * nbins, 0.0F);
+  group_im.assign(npartitions * nbins, 0.0F);
+
+  group_kernel_mask = 0U;
+
+  fdl_re.assign(2U * npartitions * nbins, 0.0F);
+  fdl_im.assign(2U * npartitions * nbins, 0.0F);
+  acc_re.resize(nbins);
+  acc_im.resize(nbins);
+  last_block.assign(2U * nsamples, 0.0F);
+
+  fdl_pos = 0U;
+
+  ready = true;
+
+  util::debug(log_tag + std::to_string(nbands) + " bands, " + std::to_string(npartitions) + " partitions of " +
+              std::to_string(nsamples) + " samples");
+}
+
+void Filterbank::multiply_accumulate(const float* kernel_re, const float* kernel_im, const uint& channel) {
+  std::fill(acc_re.begin(), acc_re.end(), 0.0F);
+  std::fill(acc_im.begin(), acc_im.end(), 0.0F);
+
+  float* __restrict ar = acc_re.data();
+  float* __restrict ai = acc_im.data();
+
+  for (uint p = 0U; p < npartitions; p++) {
+    // the input spectrum delayed by p blocks goes with the partition p of the kernel
+
+    uint slot = (fdl_pos + p) % npartitions;
+
+    const float* __restrict hr = kernel_re + p * nbins;
+    const float* __restrict hi = kernel_im + p * nbins;
+    const float* __restrict xr = fdl_re.data() + (channel * npartitions + slot) * nbins;
+    const float* __restrict xi = fdl_im.data() + (channel * npartitions + slot) * nbins;
+
+    for (uint k = 0U; k < nbins; k++) {
+      ar[k] += xr[k] * hr[k] - xi[k] * hi[k];
+      ai[k] += xr[k] * hi[k] + xi[k] * hr[k];
+    }
+  }
+
+  for (uint k = 0U; k < nbins; k++) {
+    freq_data[k][0] = ar[k];
+    freq_data[k][1] = ai[k];
+  }
+}
+
+void Filterbank::inverse(const uint& channel, float* output) {
+  fftwf_execute(backward);
+
+  // the first half has the circular convolution wrap around. Only the second one is valid
+
+  std::memcpy(output + channel * nsamples, time_data + nsamples, nsamples * sizeof(float));
+}
+
+/*
+  The spectra of the kernels are added only when the group changes. It costs about as much as filtering the group
+  band by band for one block.
+*/
+
+void Filterbank::update_group(const uint32_t& group_mask) {
+  if (group_mask == group_kernel_mask) {
+    return;
+  }
+
+  std::fill(group_re.begin(), group_re.end(), 0.0F);
+  std::fill(group_im.begin(), group_im.end(), 0.0F);
+
+  size_t size = npartitions * nbins;
+
+  for (uint b = 0U; b < nbands; b++) {
+    if ((group_mask & (1U << b)) == 0U) {
+      continue;
+    }
+
+    const float* hr = kernels_re.data() + b * size;
+    const float* hi = kernels_im.data() + b * size;
+
+    for (size_t k = 0U; k < size; k++) {
+      group_re[k] += hr[k];
+      group_im[k] += hi[k];
+    }
+  }
+
+  group_kernel_mask = group_mask;
+}
+
+void Filterbank::process(const float* data,
+                         std::vector<std::vector<float>>& output,
+                         const uint32_t& skip_mask,
+                         const uint32_t& group_mask,
+                         std::vector<float>& group_output) {
+  if (!ready) {
+    return;
+  }
+
+  // the oldest slot of the delay line receives the spectrum of this block
+
+  fdl_pos = (fdl_pos == 0U) ? npartitions - 1U : fdl_pos - 1U;
+
+  for (uint c = 0U; c < 2U; c++) {
+    float* last = last_block.data() + c * nsamples;
+
+    // overlap-save: the transform sees the previous block followed by the current one
+
+    std::memcpy(time_data, last, nsamples * sizeof(float));
+
+    for (uint n = 0U; n < nsamples; n++) {
+      last[n] = data[2U * n + c];
+    }
+
+    std::memcpy(time_data + nsamples, last, nsamples * sizeof(float));
+
+    fftwf_execute(forward);
+
+    uint offset = (c * npartitions + fdl_pos) * nbins;
+
+    for (uint k = 0U; k < nbins; k++) {
+      fdl_re[offset + k] = freq_data[k][0];
+      fdl_im[offset + k] = freq_data[k][1];
+    }
+  }
+
+  for (uint b = 0U; b < nbands; b++) {
+    if (((skip_mask | group_mask) & (1U << b)) != 0U) {
+      continue;
+    }
+
+    const float* hr = kernels_re.data() + b * npartitions * nbins;
+    const float* hi = kernels_im.data() + b * npartitions * nbins;
+
+    for (uint c = 0U; c < 2U; c++) {
+      multiply_accumulate(hr, hi, c);
+
+      inverse(c, output[b].data());
+    }
+  }
+
+  if (group_mask != 0U) {
+    update_group(group_mask);
+
+    for (uint c = 0U; c < 2U; c++) {
+      multiply_accumulate(group_re.data(), group_im.data(), c);
+
+      inverse(c, group_output.data());
+    }
+  }
+}
+
+void Filterbank::finish() {
+  ready = false;
+
+  if (forward != nullptr) {
+    fftwf_destroy_plan(forward);
+
+    forward = nullptr;
+  }
+
+  if (backward != nullptr) {
+    fftwf_destroy_plan(backward);
+
+    backward = nullptr;
+  }
+
+  if (time_data != nullptr) {
+    fftwf_free(time_data);
+
+    time_data = nullptr;
+  }
+
+  if (freq_data != nullptr) {
+    fftwf_free(freq_data);
+
+    freq_data = nullptr;
+  }
+}
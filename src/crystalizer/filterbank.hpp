@@ -0,0 +1,95 @@
+/*
+ *  Copyright © 2017-2020 Wellington Wallace
+ *
+ *  This file is part of PulseEffects.
+ *
+ *  PulseEffects is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  PulseEffects is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with PulseEffects.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef FILTERBANK_HPP
+#define FILTERBANK_HPP
+
+#include <fftw3.h>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "util.hpp"
+
+/*
+  Stereo filter bank using uniformly partitioned overlap-save convolution. All the bands see the same input so each
+  block of each channel is transformed only once. The spectra of the last blocks are kept in a frequency domain delay
+  line that is shared by all the bands. Every band then costs one complex multiply-accumulate per kernel partition and
+  one inverse transform.
+*/
+
+class Filterbank {
+ public:
+  Filterbank(const std::string& tag);
+  Filterbank(const Filterbank&) = delete;
+  auto operator=(const Filterbank&) -> Filterbank& = delete;
+  Filterbank(const Filterbank&&) = delete;
+  auto operator=(const Filterbank&&) -> Filterbank& = delete;
+  ~Filterbank();
+
+  bool ready = false;
+
+  // one kernel per band. The block size is also the partition size
+
+  void create(const uint& block_size, const std::vector<std::vector<float>>& kernels);
+
+  /*
+    Filters a block of block_size interleaved stereo frames. The output of band n is written planar to output[n]:
+    the left channel followed by the right one.
+
+    Bands in skip_mask are not computed. The bands in group_mask are not computed one by one. Their sum is written
+    to group_output instead. The filter is linear so it is the input filtered by the sum of their kernels. This costs
+    as much as a single band.
+  */
+
+  void process(const float* data,
+               std::vector<std::vector<float>>& output,
+               const uint32_t& skip_mask,
+               const uint32_t& group_mask,
+               std::vector<float>& group_output);
+
+  void finish();
+
+ private:
+  std::string log_tag;
+
+  uint nsamples = 0U, nbins = 0U, nbands = 0U, npartitions = 0U;
+
+  uint fdl_pos = 0U;  // slot of the delay line that has the spectrum of the current block
+
+  float* time_data = nullptr;          // 2 * nsamples real samples given to and returned by fftw
+  fftwf_complex* freq_data = nullptr;  // nbins complex values given to and returned by fftw
+
+  fftwf_plan forward = nullptr, backward = nullptr;
+
+  std::vector<float> kernels_re, kernels_im;  // [band][partition][bin] already scaled by 1 / fft size
+  std::vector<float> group_re, group_im;      // [partition][bin] sum of the kernels in the group
+  std::vector<float> fdl_re, fdl_im;          // [channel][partition][bin]
+  std::vector<float> last_block;              // previous input block of each channel. Planar
+  std::vector<float> acc_re, acc_im;          // spectrum of the band being computed
+
+  uint32_t group_kernel_mask = 0U;  // bands summed in group_re and group_im
+
+  void multiply_accumulate(const float* kernel_re, const float* kernel_im, const uint& channel);
+
+  void inverse(const uint& channel, float* output);
+
+  void update_group(const uint32_t& group_mask);
+};
+
+#endif
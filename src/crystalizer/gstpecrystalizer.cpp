@@ -36,11 +36,18 @@
 #include <gst/gst.h>
 #include <algorithm>
 #include <cmath>
+#include <cstring>
 #include "config.h"
+#include "band_cache.hpp"
+#include "fftw_wisdom.hpp"
 
 GST_DEBUG_CATEGORY_STATIC(gst_pecrystalizer_debug_category);
 #define GST_CAT_DEFAULT gst_pecrystalizer_debug_category
 
+// four samples of a band channel are enhanced at once
+
+typedef float float4_t __attribute__((vector_size(16)));
+
 /* prototypes */
 
 static void gst_pecrystalizer_set_property(GObject* object, guint property_id, const GValue* value, GParamSpec* pspec);
@@ -55,12 +62,18 @@ static gboolean gst_pecrystalizer_stop(GstBaseTransform* base);
 
 static void gst_pecrystalizer_setup_filters(GstPecrystalizer* pecrystalizer);
 
+static auto gst_pecrystalizer_filters_ready(GstPecrystalizer* pecrystalizer) -> bool;
+
 static void gst_pecrystalizer_process(GstPecrystalizer* pecrystalizer, GstBuffer* buffer);
 
 static gboolean gst_pecrystalizer_src_query(GstPad* pad, GstObject* parent, GstQuery* query);
 
 static void gst_pecrystalizer_finish_filters(GstPecrystalizer* pecrystalizer);
 
+static void gst_pecrystalizer_publish_bands(GstPecrystalizer* pecrystalizer);
+
+static void gst_pecrystalizer_pick_bands(GstPecrystalizer* pecrystalizer);
+
 static void gst_pecrystalizer_finalize(GObject* object);
 
 enum {
@@ -106,9 +119,29 @@ enum {
   PROP_RANGE_BEFORE,
   PROP_RANGE_AFTER,
   PROP_AGGRESSIVE,
-  PROP_NOTIFY
+  PROP_NOTIFY,
+  PROP_CROSSOVER,
+  PROP_BANDS
 };
 
+#define GST_TYPE_PECRYSTALIZER_CROSSOVER (gst_pecrystalizer_crossover_get_type())
+
+static GType gst_pecrystalizer_crossover_get_type() {
+  static GType type = 0;
+
+  static const GEnumValue values[] = {
+      {PECRYSTALIZER_CROSSOVER_LINEAR_PHASE, "Linear phase FIR filters", "linear-phase"},
+      {PECRYSTALIZER_CROSSOVER_LOW_LATENCY, "Low latency Linkwitz-Riley crossovers", "low-latency"},
+      {PECRYSTALIZER_CROSSOVER_MINIMUM_PHASE, "Minimum phase FIR filters", "minimum-phase"},
+      {0, nullptr, nullptr}};
+
+  if (type == 0) {
+    type = g_enum_register_static("GstPecrystalizerCrossover", values);
+  }
+
+  return type;
+}
+
 /* pad templates */
 
 static GstStaticPadTemplate gst_pecrystalizer_src_template =
@@ -152,6 +185,10 @@ static void gst_pecrystalizer_class_init(GstPecrystalizerClass* klass) {
                                         "PulseEffects Crystalizer is a port of FFMPEG crystalizer",
                                         "Wellington <wellingtonwallace@gmail.com>");
 
+  // the filter bank plans its ffts when it is created. Measured plans have to be known before that
+
+  fftw_wisdom::load();
+
   /* define virtual function pointers */
 
   gobject_class->set_property = gst_pecrystalizer_set_property;
@@ -260,12 +297,25 @@ static void gst_pecrystalizer_class_init(GstPecrystalizerClass* klass) {
       gobject_class, PROP_NOTIFY,
       g_param_spec_boolean("notify-host", "Notify Host", "Notify host of variable changes", true,
                            static_cast<GParamFlags>(G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS)));
+
+  g_object_class_install_property(
+      gobject_class, PROP_CROSSOVER,
+      g_param_spec_enum("crossover", "Crossover", "Filters used to split the bands", GST_TYPE_PECRYSTALIZER_CROSSOVER,
+                        PECRYSTALIZER_CROSSOVER_LINEAR_PHASE,
+                        static_cast<GParamFlags>(G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS)));
+
+  g_object_class_install_property(
+      gobject_class, PROP_BANDS,
+      g_param_spec_variant("bands", "Bands",
+                           "Intensity, mute and bypass of all the bands in a single update. An array of (dbb)",
+                           G_VARIANT_TYPE("a(dbb)"), nullptr,
+                           static_cast<GParamFlags>(G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS)));
 }
 
 static void gst_pecrystalizer_init(GstPecrystalizer* pecrystalizer) {
-  pecrystalizer->ready = false;
   pecrystalizer->bpf = 0;
   pecrystalizer->nsamples = 0;
+  pecrystalizer->latency = 0U;
 
   pecrystalizer->freqs[0] = 500.0F;
   pecrystalizer->freqs[1] = 1000.0F;
@@ -280,27 +330,48 @@ static void gst_pecrystalizer_init(GstPecrystalizer* pecrystalizer) {
   pecrystalizer->freqs[10] = 10000.0F;
   pecrystalizer->freqs[11] = 15000.0F;
 
-  for (int n = 0; n < NBANDS; n++) {
-    pecrystalizer->filters[n] = new Filter("crystalizer band" + std::to_string(n));
+  pecrystalizer->crossover_mode = PECRYSTALIZER_CROSSOVER_LINEAR_PHASE;
+  pecrystalizer->filterbank = new Filterbank("crystalizer: ");
+  pecrystalizer->crossover = new Crossover("crystalizer: ");
+
+  pecrystalizer->band_data.resize(NBANDS);
 
-    pecrystalizer->intensities[n] = 1.0F;
-    pecrystalizer->mute[n] = false;
-    pecrystalizer->bypass[n] = false;
+  for (int n = 0; n < NBANDS; n++) {
+    pecrystalizer->bands_params.intensities[n] = 1.0F;
+    pecrystalizer->bands_params.mute[n] = false;
+    pecrystalizer->bands_params.bypass[n] = false;
     pecrystalizer->last_L[n] = 0.0F;
     pecrystalizer->last_R[n] = 0.0F;
+    pecrystalizer->delayed_L[n] = 0.0F;
+    pecrystalizer->delayed_R[n] = 0.0F;
   }
 
+  pecrystalizer->group_last_L = pecrystalizer->group_last_R = 0.0F;
+  pecrystalizer->group_delayed_L = pecrystalizer->group_delayed_R = 0.0F;
+  pecrystalizer->group_mask = 0U;
+
   pecrystalizer->sample_count = 0;
   pecrystalizer->notify = false;
-  pecrystalizer->range_before = 0.0F;
-  pecrystalizer->range_after = 0.0F;
-  pecrystalizer->ebur_state_before = nullptr;
-  pecrystalizer->ebur_state_after = nullptr;
+  // only the loudness range before and after the processing is read. Like before it covers the last 30 seconds
+
+  pecrystalizer->loudness =
+      new LoudnessAnalyzer("crystalizer: ", {LoudnessAnalyzer::range, LoudnessAnalyzer::range}, 30U * 1000U);
 
   pecrystalizer->ndivs = 1000U;
   pecrystalizer->dv = 1.0F / pecrystalizer->ndivs;
   pecrystalizer->aggressive = false;
 
+  // the aggressive mode reads the gain tables before any intensity is set
+
+  for (int n = 0; n < NBANDS; n++) {
+    pecrystalizer->bands_params.gain[n] =
+        util::linspace(1.0F, pecrystalizer->bands_params.intensities[n], pecrystalizer->ndivs);
+  }
+
+  pecrystalizer->bands = new PecrystalizerBands(pecrystalizer->bands_params);
+  pecrystalizer->next_bands = nullptr;
+  pecrystalizer->retired_bands = nullptr;
+
   pecrystalizer->sinkpad = gst_element_get_static_pad(GST_ELEMENT(pecrystalizer), "sink");
 
   pecrystalizer->srcpad = gst_element_get_static_pad(GST_ELEMENT(pecrystalizer), "src");
@@ -315,178 +386,90 @@ void gst_pecrystalizer_set_property(GObject* object, guint property_id, const GV
 
   GST_DEBUG_OBJECT(pecrystalizer, "set_property");
 
-  switch (property_id) {
-    // Intensities
-    case PROP_INTENSITY_BAND0: {
-      pecrystalizer->intensities[0] = g_value_get_float(value);
-      pecrystalizer->gain[0] = util::linspace(1.0F, pecrystalizer->intensities[0], pecrystalizer->ndivs);
+  if (property_id >= PROP_INTENSITY_BAND0 && property_id <= PROP_BYPASS_BAND12) {
+    std::lock_guard<std::mutex> lock(pecrystalizer->bands_mutex);
 
-      break;
-    }
-    case PROP_INTENSITY_BAND1: {
-      pecrystalizer->intensities[1] = g_value_get_float(value);
-      pecrystalizer->gain[1] = util::linspace(1.0F, pecrystalizer->intensities[1], pecrystalizer->ndivs);
+    auto& params = pecrystalizer->bands_params;
 
-      break;
-    }
-    case PROP_INTENSITY_BAND2: {
-      pecrystalizer->intensities[2] = g_value_get_float(value);
-      pecrystalizer->gain[2] = util::linspace(1.0F, pecrystalizer->intensities[2], pecrystalizer->ndivs);
+    if (property_id <= PROP_INTENSITY_BAND12) {
+      uint n = property_id - PROP_INTENSITY_BAND0;
 
-      break;
+      params.intensities[n] = g_value_get_float(value);
+      params.gain[n] = util::linspace(1.0F, params.intensities[n], pecrystalizer->ndivs);
+    } else if (property_id <= PROP_MUTE_BAND12) {
+      params.mute[property_id - PROP_MUTE_BAND0] = g_value_get_boolean(value);
+    } else {
+      params.bypass[property_id - PROP_BYPASS_BAND0] = g_value_get_boolean(value);
     }
-    case PROP_INTENSITY_BAND3: {
-      pecrystalizer->intensities[3] = g_value_get_float(value);
-      pecrystalizer->gain[3] = util::linspace(1.0F, pecrystalizer->intensities[3], pecrystalizer->ndivs);
 
-      break;
-    }
-    case PROP_INTENSITY_BAND4: {
-      pecrystalizer->intensities[4] = g_value_get_float(value);
-      pecrystalizer->gain[4] = util::linspace(1.0F, pecrystalizer->intensities[4], pecrystalizer->ndivs);
+    gst_pecrystalizer_publish_bands(pecrystalizer);
 
-      break;
-    }
-    case PROP_INTENSITY_BAND5: {
-      pecrystalizer->intensities[5] = g_value_get_float(value);
-      pecrystalizer->gain[5] = util::linspace(1.0F, pecrystalizer->intensities[5], pecrystalizer->ndivs);
+    return;
+  }
 
+  switch (property_id) {
+    // Aggressive
+    case PROP_AGGRESSIVE:
+      pecrystalizer->aggressive = g_value_get_boolean(value);
       break;
-    }
-    case PROP_INTENSITY_BAND6: {
-      pecrystalizer->intensities[6] = g_value_get_float(value);
-      pecrystalizer->gain[6] = util::linspace(1.0F, pecrystalizer->intensities[6], pecrystalizer->ndivs);
 
+    // Notify
+    case PROP_NOTIFY:
+      pecrystalizer->notify = g_value_get_boolean(value);
       break;
-    }
-    case PROP_INTENSITY_BAND7: {
-      pecrystalizer->intensities[7] = g_value_get_float(value);
-      pecrystalizer->gain[7] = util::linspace(1.0F, pecrystalizer->intensities[7], pecrystalizer->ndivs);
 
-      break;
-    }
-    case PROP_INTENSITY_BAND8: {
-      pecrystalizer->intensities[8] = g_value_get_float(value);
-      pecrystalizer->gain[8] = util::linspace(1.0F, pecrystalizer->intensities[8], pecrystalizer->ndivs);
+    // Crossover
+    case PROP_CROSSOVER: {
+      std::lock_guard<std::mutex> lock(pecrystalizer->mutex);
 
-      break;
-    }
-    case PROP_INTENSITY_BAND9: {
-      pecrystalizer->intensities[9] = g_value_get_float(value);
-      pecrystalizer->gain[9] = util::linspace(1.0F, pecrystalizer->intensities[9], pecrystalizer->ndivs);
+      int mode = g_value_get_enum(value);
 
-      break;
-    }
-    case PROP_INTENSITY_BAND10: {
-      pecrystalizer->intensities[10] = g_value_get_float(value);
-      pecrystalizer->gain[10] = util::linspace(1.0F, pecrystalizer->intensities[10], pecrystalizer->ndivs);
+      if (mode != pecrystalizer->crossover_mode) {
+        pecrystalizer->crossover_mode = mode;
 
-      break;
-    }
-    case PROP_INTENSITY_BAND11: {
-      pecrystalizer->intensities[11] = g_value_get_float(value);
-      pecrystalizer->gain[11] = util::linspace(1.0F, pecrystalizer->intensities[11], pecrystalizer->ndivs);
+        // the next buffer creates the filters of the new mode
 
-      break;
-    }
-    case PROP_INTENSITY_BAND12: {
-      pecrystalizer->intensities[12] = g_value_get_float(value);
-      pecrystalizer->gain[12] = util::linspace(1.0F, pecrystalizer->intensities[12], pecrystalizer->ndivs);
+        gst_pecrystalizer_finish_filters(pecrystalizer);
+      }
 
       break;
     }
 
-    // Mute
-    case PROP_MUTE_BAND0:
-      pecrystalizer->mute[0] = g_value_get_boolean(value);
-      break;
-    case PROP_MUTE_BAND1:
-      pecrystalizer->mute[1] = g_value_get_boolean(value);
-      break;
-    case PROP_MUTE_BAND2:
-      pecrystalizer->mute[2] = g_value_get_boolean(value);
-      break;
-    case PROP_MUTE_BAND3:
-      pecrystalizer->mute[3] = g_value_get_boolean(value);
-      break;
-    case PROP_MUTE_BAND4:
-      pecrystalizer->mute[4] = g_value_get_boolean(value);
-      break;
-    case PROP_MUTE_BAND5:
-      pecrystalizer->mute[5] = g_value_get_boolean(value);
-      break;
-    case PROP_MUTE_BAND6:
-      pecrystalizer->mute[6] = g_value_get_boolean(value);
-      break;
-    case PROP_MUTE_BAND7:
-      pecrystalizer->mute[7] = g_value_get_boolean(value);
-      break;
-    case PROP_MUTE_BAND8:
-      pecrystalizer->mute[8] = g_value_get_boolean(value);
-      break;
-    case PROP_MUTE_BAND9:
-      pecrystalizer->mute[9] = g_value_get_boolean(value);
-      break;
-    case PROP_MUTE_BAND10:
-      pecrystalizer->mute[10] = g_value_get_boolean(value);
-      break;
-    case PROP_MUTE_BAND11:
-      pecrystalizer->mute[11] = g_value_get_boolean(value);
-      break;
-    case PROP_MUTE_BAND12:
-      pecrystalizer->mute[12] = g_value_get_boolean(value);
-      break;
+    // Bands
+    case PROP_BANDS: {
+      GVariant* variant = g_value_get_variant(value);
 
-    // Bypass
-    case PROP_BYPASS_BAND0:
-      pecrystalizer->bypass[0] = g_value_get_boolean(value);
-      break;
-    case PROP_BYPASS_BAND1:
-      pecrystalizer->bypass[1] = g_value_get_boolean(value);
-      break;
-    case PROP_BYPASS_BAND2:
-      pecrystalizer->bypass[2] = g_value_get_boolean(value);
-      break;
-    case PROP_BYPASS_BAND3:
-      pecrystalizer->bypass[3] = g_value_get_boolean(value);
-      break;
-    case PROP_BYPASS_BAND4:
-      pecrystalizer->bypass[4] = g_value_get_boolean(value);
-      break;
-    case PROP_BYPASS_BAND5:
-      pecrystalizer->bypass[5] = g_value_get_boolean(value);
-      break;
-    case PROP_BYPASS_BAND6:
-      pecrystalizer->bypass[6] = g_value_get_boolean(value);
-      break;
-    case PROP_BYPASS_BAND7:
-      pecrystalizer->bypass[7] = g_value_get_boolean(value);
-      break;
-    case PROP_BYPASS_BAND8:
-      pecrystalizer->bypass[8] = g_value_get_boolean(value);
-      break;
-    case PROP_BYPASS_BAND9:
-      pecrystalizer->bypass[9] = g_value_get_boolean(value);
-      break;
-    case PROP_BYPASS_BAND10:
-      pecrystalizer->bypass[10] = g_value_get_boolean(value);
-      break;
-    case PROP_BYPASS_BAND11:
-      pecrystalizer->bypass[11] = g_value_get_boolean(value);
-      break;
-    case PROP_BYPASS_BAND12:
-      pecrystalizer->bypass[12] = g_value_get_boolean(value);
-      break;
+      if (variant == nullptr || g_variant_n_children(variant) != NBANDS) {
+        util::warning("crystalizer: the bands property needs " + std::to_string(NBANDS) + " elements");
 
-    // Aggressive
-    case PROP_AGGRESSIVE:
-      pecrystalizer->aggressive = g_value_get_boolean(value);
-      break;
+        break;
+      }
+
+      std::lock_guard<std::mutex> lock(pecrystalizer->bands_mutex);
+
+      auto& params = pecrystalizer->bands_params;
+
+      for (uint n = 0U; n < NBANDS; n++) {
+        double intensity = 1.0;
+        gboolean mute = false, bypass = false;
+
+        g_variant_get_child(variant, n, "(dbb)", &intensity, &mute, &bypass);
+
+        // the gain tables are only computed again for the intensities that changed
+
+        if (static_cast<float>(intensity) != params.intensities[n] || params.gain[n].empty()) {
+          params.intensities[n] = static_cast<float>(intensity);
+          params.gain[n] = util::linspace(1.0F, params.intensities[n], pecrystalizer->ndivs);
+        }
+
+        params.mute[n] = mute != 0;
+        params.bypass[n] = bypass != 0;
+      }
+
+      gst_pecrystalizer_publish_bands(pecrystalizer);
 
-    // Notify
-    case PROP_NOTIFY:
-      pecrystalizer->notify = g_value_get_boolean(value);
       break;
+    }
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID(object, property_id, pspec);
       break;
@@ -498,136 +481,29 @@ void gst_pecrystalizer_get_property(GObject* object, guint property_id, GValue*
 
   GST_DEBUG_OBJECT(pecrystalizer, "get_property");
 
-  switch (property_id) {
-    // Intensities
-    case PROP_INTENSITY_BAND0:
-      g_value_set_float(value, pecrystalizer->intensities[0]);
-      break;
-    case PROP_INTENSITY_BAND1:
-      g_value_set_float(value, pecrystalizer->intensities[1]);
-      break;
-    case PROP_INTENSITY_BAND2:
-      g_value_set_float(value, pecrystalizer->intensities[2]);
-      break;
-    case PROP_INTENSITY_BAND3:
-      g_value_set_float(value, pecrystalizer->intensities[3]);
-      break;
-    case PROP_INTENSITY_BAND4:
-      g_value_set_float(value, pecrystalizer->intensities[4]);
-      break;
-    case PROP_INTENSITY_BAND5:
-      g_value_set_float(value, pecrystalizer->intensities[5]);
-      break;
-    case PROP_INTENSITY_BAND6:
-      g_value_set_float(value, pecrystalizer->intensities[6]);
-      break;
-    case PROP_INTENSITY_BAND7:
-      g_value_set_float(value, pecrystalizer->intensities[7]);
-      break;
-    case PROP_INTENSITY_BAND8:
-      g_value_set_float(value, pecrystalizer->intensities[8]);
-      break;
-    case PROP_INTENSITY_BAND9:
-      g_value_set_float(value, pecrystalizer->intensities[9]);
-      break;
-    case PROP_INTENSITY_BAND10:
-      g_value_set_float(value, pecrystalizer->intensities[10]);
-      break;
-    case PROP_INTENSITY_BAND11:
-      g_value_set_float(value, pecrystalizer->intensities[11]);
-      break;
-    case PROP_INTENSITY_BAND12:
-      g_value_set_float(value, pecrystalizer->intensities[12]);
-      break;
+  if (property_id >= PROP_INTENSITY_BAND0 && property_id <= PROP_BYPASS_BAND12) {
+    std::lock_guard<std::mutex> lock(pecrystalizer->bands_mutex);
 
-    // Mute
-    case PROP_MUTE_BAND0:
-      g_value_set_boolean(value, pecrystalizer->mute[0]);
-      break;
-    case PROP_MUTE_BAND1:
-      g_value_set_boolean(value, pecrystalizer->mute[1]);
-      break;
-    case PROP_MUTE_BAND2:
-      g_value_set_boolean(value, pecrystalizer->mute[2]);
-      break;
-    case PROP_MUTE_BAND3:
-      g_value_set_boolean(value, pecrystalizer->mute[3]);
-      break;
-    case PROP_MUTE_BAND4:
-      g_value_set_boolean(value, pecrystalizer->mute[4]);
-      break;
-    case PROP_MUTE_BAND5:
-      g_value_set_boolean(value, pecrystalizer->mute[5]);
-      break;
-    case PROP_MUTE_BAND6:
-      g_value_set_boolean(value, pecrystalizer->mute[6]);
-      break;
-    case PROP_MUTE_BAND7:
-      g_value_set_boolean(value, pecrystalizer->mute[7]);
-      break;
-    case PROP_MUTE_BAND8:
-      g_value_set_boolean(value, pecrystalizer->mute[8]);
-      break;
-    case PROP_MUTE_BAND9:
-      g_value_set_boolean(value, pecrystalizer->mute[9]);
-      break;
-    case PROP_MUTE_BAND10:
-      g_value_set_boolean(value, pecrystalizer->mute[10]);
-      break;
-    case PROP_MUTE_BAND11:
-      g_value_set_boolean(value, pecrystalizer->mute[11]);
-      break;
-    case PROP_MUTE_BAND12:
-      g_value_set_boolean(value, pecrystalizer->mute[12]);
-      break;
+    auto& params = pecrystalizer->bands_params;
 
-    // Bypass
-    case PROP_BYPASS_BAND0:
-      g_value_set_boolean(value, pecrystalizer->bypass[0]);
-      break;
-    case PROP_BYPASS_BAND1:
-      g_value_set_boolean(value, pecrystalizer->bypass[1]);
-      break;
-    case PROP_BYPASS_BAND2:
-      g_value_set_boolean(value, pecrystalizer->bypass[2]);
-      break;
-    case PROP_BYPASS_BAND3:
-      g_value_set_boolean(value, pecrystalizer->bypass[3]);
-      break;
-    case PROP_BYPASS_BAND4:
-      g_value_set_boolean(value, pecrystalizer->bypass[4]);
-      break;
-    case PROP_BYPASS_BAND5:
-      g_value_set_boolean(value, pecrystalizer->bypass[5]);
-      break;
-    case PROP_BYPASS_BAND6:
-      g_value_set_boolean(value, pecrystalizer->bypass[6]);
-      break;
-    case PROP_BYPASS_BAND7:
-      g_value_set_boolean(value, pecrystalizer->bypass[7]);
-      break;
-    case PROP_BYPASS_BAND8:
-      g_value_set_boolean(value, pecrystalizer->bypass[8]);
-      break;
-    case PROP_BYPASS_BAND9:
-      g_value_set_boolean(value, pecrystalizer->bypass[9]);
-      break;
-    case PROP_BYPASS_BAND10:
-      g_value_set_boolean(value, pecrystalizer->bypass[10]);
-      break;
-    case PROP_BYPASS_BAND11:
-      g_value_set_boolean(value, pecrystalizer->bypass[11]);
-      break;
-    case PROP_BYPASS_BAND12:
-      g_value_set_boolean(value, pecrystalizer->bypass[12]);
-      break;
+    if (property_id <= PROP_INTENSITY_BAND12) {
+      g_value_set_float(value, params.intensities[property_id - PROP_INTENSITY_BAND0]);
+    } else if (property_id <= PROP_MUTE_BAND12) {
+      g_value_set_boolean(value, params.mute[property_id - PROP_MUTE_BAND0]);
+    } else {
+      g_value_set_boolean(value, params.bypass[property_id - PROP_BYPASS_BAND0]);
+    }
 
+    return;
+  }
+
+  switch (property_id) {
     // Range
     case PROP_RANGE_BEFORE:
-      g_value_set_float(value, pecrystalizer->range_before);
+      g_value_set_float(value, pecrystalizer->loudness->snapshot(0U).range);
       break;
     case PROP_RANGE_AFTER:
-      g_value_set_float(value, pecrystalizer->range_after);
+      g_value_set_float(value, pecrystalizer->loudness->snapshot(1U).range);
       break;
 
     // Aggressive
@@ -639,6 +515,31 @@ void gst_pecrystalizer_get_property(GObject* object, guint property_id, GValue*
     case PROP_NOTIFY:
       g_value_set_boolean(value, pecrystalizer->notify);
       break;
+
+    // Crossover
+    case PROP_CROSSOVER:
+      g_value_set_enum(value, pecrystalizer->crossover_mode);
+      break;
+
+    // Bands
+    case PROP_BANDS: {
+      std::lock_guard<std::mutex> lock(pecrystalizer->bands_mutex);
+
+      auto& params = pecrystalizer->bands_params;
+
+      GVariantBuilder builder;
+
+      g_variant_builder_init(&builder, G_VARIANT_TYPE("a(dbb)"));
+
+      for (uint n = 0U; n < NBANDS; n++) {
+        g_variant_builder_add(&builder, "(dbb)", static_cast<double>(params.intensities[n]),
+                              static_cast<gboolean>(params.mute[n]), static_cast<gboolean>(params.bypass[n]));
+      }
+
+      g_value_set_variant(value, g_variant_builder_end(&builder));
+
+      break;
+    }
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID(object, property_id, pspec);
       break;
@@ -679,13 +580,7 @@ static GstFlowReturn gst_pecrystalizer_transform_ip(GstBaseTransform* trans, Gst
 
   gst_buffer_unmap(buffer, &map);
 
-  bool filters_ready = true;
-
-  for (int n = 0; n < NBANDS; n++) {
-    filters_ready = filters_ready && pecrystalizer->filters[n]->ready;
-  }
-
-  if (filters_ready) {
+  if (gst_pecrystalizer_filters_ready(pecrystalizer)) {
     if (pecrystalizer->nsamples == num_samples) {
       gst_pecrystalizer_process(pecrystalizer, buffer);
     } else {
@@ -713,6 +608,33 @@ static gboolean gst_pecrystalizer_stop(GstBaseTransform* base) {
   return true;
 }
 
+/*
+  The bands add up to the impulse response of the whole filter bank. Its peak is where a transient comes out. For
+  linear phase kernels it is their center.
+*/
+
+static auto gst_pecrystalizer_kernels_delay(const std::vector<std::vector<float>>& kernels) -> uint {
+  std::vector<float> sum;
+
+  for (const auto& k : kernels) {
+    if (k.size() > sum.size()) {
+      sum.resize(k.size(), 0.0F);
+    }
+
+    for (size_t n = 0U; n < k.size(); n++) {
+      sum[n] += k[n];
+    }
+  }
+
+  if (sum.empty()) {
+    return 0U;
+  }
+
+  auto peak = std::max_element(sum.begin(), sum.end(), [](float a, float b) { return std::fabs(a) < std::fabs(b); });
+
+  return static_cast<uint>(peak - sum.begin());
+}
+
 static void gst_pecrystalizer_setup_filters(GstPecrystalizer* pecrystalizer) {
   if (pecrystalizer->rate != 0) {
     for (int n = 0; n < NBANDS; n++) {
@@ -721,54 +643,209 @@ static void gst_pecrystalizer_setup_filters(GstPecrystalizer* pecrystalizer) {
       }
     }
 
-    if (pecrystalizer->deriv2.size() != 2U * pecrystalizer->nsamples) {
-      pecrystalizer->deriv2.resize(2U * pecrystalizer->nsamples);
+    if (pecrystalizer->output.size() != 2U * pecrystalizer->nsamples) {
+      pecrystalizer->output.resize(2U * pecrystalizer->nsamples);
     }
 
-    /*
-      Bandpass transition band has to be twice the value used for lowpass and
-      highpass. This way all filters will have the same delay.
-    */
+    if (pecrystalizer->group_data.size() != 2U * pecrystalizer->nsamples) {
+      pecrystalizer->group_data.resize(2U * pecrystalizer->nsamples);
+    }
 
-    float transition_band = 100.0F;  // Hz
+    if (pecrystalizer->crossover_mode == PECRYSTALIZER_CROSSOVER_LOW_LATENCY) {
+      pecrystalizer->crossover->create(pecrystalizer->rate,
+                                       std::vector<float>(pecrystalizer->freqs.begin(), pecrystalizer->freqs.end()));
 
-    for (uint n = 0U; n < NBANDS; n++) {
-      if (n == 0U) {
-        pecrystalizer->filters[0]->create_lowpass(pecrystalizer->nsamples, pecrystalizer->rate, pecrystalizer->freqs[0],
-                                                  transition_band);
-      } else if (n == pecrystalizer->filters.size() - 1U) {
-        pecrystalizer->filters[n]->create_highpass(pecrystalizer->nsamples, pecrystalizer->rate,
-                                                   pecrystalizer->freqs.back(), transition_band);
-      } else {
-        pecrystalizer->filters[n]->create_bandpass(pecrystalizer->nsamples, pecrystalizer->rate,
-                                                   pecrystalizer->freqs[n - 1U], pecrystalizer->freqs[n],
-                                                   2.0F * transition_band);
+      pecrystalizer->latency = 0U;
+    } else {
+      /*
+        Bandpass transition band has to be twice the value used for lowpass and
+        highpass. This way all filters will have the same delay.
+      */
+
+      float transition_band = 100.0F;  // Hz
+
+      // everything the kernels depend on
+
+      std::string key = std::to_string(pecrystalizer->rate) + ":" + std::to_string(pecrystalizer->crossover_mode) +
+                        ":" + std::to_string(transition_band);
+
+      for (auto& f : pecrystalizer->freqs) {
+        key += ":" + std::to_string(f);
+      }
+
+      std::vector<std::vector<float>> kernels;
+
+      if (!band_cache::load(key, kernels) || kernels.size() != NBANDS) {
+        kernels.resize(NBANDS);
+
+        for (uint n = 0U; n < NBANDS; n++) {
+          Filter filter("crystalizer band" + std::to_string(n));
+
+          if (n == 0U) {
+            filter.create_lowpass(pecrystalizer->rate, pecrystalizer->freqs[0], transition_band);
+          } else if (n == NBANDS - 1U) {
+            filter.create_highpass(pecrystalizer->rate, pecrystalizer->freqs.back(), transition_band);
+          } else {
+            filter.create_bandpass(pecrystalizer->rate, pecrystalizer->freqs[n - 1U], pecrystalizer->freqs[n],
+                                   2.0F * transition_band);
+          }
+
+          if (pecrystalizer->crossover_mode == PECRYSTALIZER_CROSSOVER_MINIMUM_PHASE) {
+            filter.make_minimum_phase();
+          }
+
+          kernels[n] = filter.get_kernel();
+        }
+
+        band_cache::store(key, kernels);
       }
+
+      pecrystalizer->latency = gst_pecrystalizer_kernels_delay(kernels);
+
+      pecrystalizer->filterbank->create(pecrystalizer->nsamples, kernels);
+    }
+
+    // the loudness range history is only lost when the rate changes
+
+    pecrystalizer->loudness->set_rate(pecrystalizer->rate);
+  }
+}
+
+static auto gst_pecrystalizer_filters_ready(GstPecrystalizer* pecrystalizer) -> bool {
+  if (pecrystalizer->crossover_mode == PECRYSTALIZER_CROSSOVER_LOW_LATENCY) {
+    return pecrystalizer->crossover->ready;
+  }
+
+  return pecrystalizer->filterbank->ready;
+}
+
+/*
+  Peak enhancement of one channel of a band fused with the aggressive mode gain and the sum of the bands. The band is
+  delayed by one sample. delayed is the last input sample of the previous block and it becomes the first output
+  sample. last is the delayed sample that came before it. Both are updated for the next block.
+
+  Without the aggressive mode there is no table lookup and the loop is done four samples at a time.
+*/
+
+template <bool aggressive>
+static inline void gst_pecrystalizer_enhance_band(const float* __restrict in,
+                                                  float* __restrict out,
+                                                  const uint& nsamples,
+                                                  const float& intensity,
+                                                  const float* gain,
+                                                  const uint& gain_size,
+                                                  const float& dv,
+                                                  float& delayed,
+                                                  float& last) {
+  auto enhance = [&](const float& lower, const float& v, const float& upper) {
+    float y = v - intensity * (upper - 2.0F * v + lower);
+
+    if (aggressive) {
+      // amplitude dependent gain
+
+      auto idx = std::min(static_cast<uint>(std::fabs(v) / dv), gain_size - 1U);
+
+      y *= gain[idx];
+    }
+
+    return y;
+  };
+
+  if (nsamples == 0U) {
+    return;
+  }
+
+  out[0] += enhance(last, delayed, in[0]);
+
+  if (nsamples == 1U) {
+    last = delayed;
+    delayed = in[0];
+
+    return;
+  }
+
+  out[1] += enhance(delayed, in[0], in[1]);
+
+  uint m = 2U;
+
+  if (!aggressive) {
+    for (; m + 4U <= nsamples; m += 4U) {
+      float4_t lower, v, upper, o;
+
+      std::memcpy(&lower, in + m - 2U, sizeof(float4_t));
+      std::memcpy(&v, in + m - 1U, sizeof(float4_t));
+      std::memcpy(&upper, in + m, sizeof(float4_t));
+      std::memcpy(&o, out + m, sizeof(float4_t));
+
+      o += v - intensity * (upper - 2.0F * v + lower);
+
+      std::memcpy(out + m, &o, sizeof(float4_t));
     }
+  }
 
-    // before
+  for (; m < nsamples; m++) {
+    out[m] += enhance(in[m - 2U], in[m - 1U], in[m]);
+  }
 
-    pecrystalizer->ebur_state_before = ebur128_init(2U, pecrystalizer->rate, EBUR128_MODE_LRA | EBUR128_MODE_HISTOGRAM);
+  last = in[nsamples - 2U];
+  delayed = in[nsamples - 1U];
+}
 
-    ebur128_set_channel(pecrystalizer->ebur_state_before, 0U, EBUR128_LEFT);
-    ebur128_set_channel(pecrystalizer->ebur_state_before, 1U, EBUR128_RIGHT);
+// a band that is not enhanced only has to be delayed by one sample like the others
 
-    ebur128_set_max_history(pecrystalizer->ebur_state_before, 30U * 1000U);  // ms
+static inline void gst_pecrystalizer_delay_band(const float* __restrict in,
+                                                float* __restrict out,
+                                                const uint& nsamples,
+                                                float& delayed,
+                                                float& last) {
+  if (nsamples == 0U) {
+    return;
+  }
 
-    // after
+  out[0] += delayed;
 
-    pecrystalizer->ebur_state_after = ebur128_init(2U, pecrystalizer->rate, EBUR128_MODE_LRA | EBUR128_MODE_HISTOGRAM);
+  for (uint m = 1U; m < nsamples; m++) {
+    out[m] += in[m - 1U];
+  }
 
-    ebur128_set_channel(pecrystalizer->ebur_state_after, 0U, EBUR128_LEFT);
-    ebur128_set_channel(pecrystalizer->ebur_state_after, 1U, EBUR128_RIGHT);
+  last = (nsamples == 1U) ? delayed : in[nsamples - 2U];
+  delayed = in[nsamples - 1U];
+}
+
+/*
+  The one sample delay of the bands that pass unchanged is kept for their sum. When a band joins the group its delayed
+  sample moves to the group state. When it leaves the group its last sample is still in the group state, which outputs
+  it at the start of the next buffer. So the band starts again from silence. Otherwise it would repeat the stale
+  sample it had when it joined the group.
+*/
 
-    ebur128_set_max_history(pecrystalizer->ebur_state_after, 30U * 1000U);  // ms
+static void gst_pecrystalizer_update_group(GstPecrystalizer* pecrystalizer, const uint32_t& passthrough) {
+  uint32_t changed = passthrough ^ pecrystalizer->group_mask;
+
+  if (changed == 0U) {
+    return;
   }
+
+  for (uint n = 0U; n < NBANDS; n++) {
+    if ((changed & (1U << n)) == 0U) {
+      continue;
+    }
+
+    if ((passthrough & (1U << n)) != 0U) {
+      pecrystalizer->group_delayed_L += pecrystalizer->delayed_L[n];
+      pecrystalizer->group_delayed_R += pecrystalizer->delayed_R[n];
+      pecrystalizer->group_last_L += pecrystalizer->last_L[n];
+      pecrystalizer->group_last_R += pecrystalizer->last_R[n];
+    }
+
+    pecrystalizer->delayed_L[n] = pecrystalizer->last_L[n] = 0.0F;
+    pecrystalizer->delayed_R[n] = pecrystalizer->last_R[n] = 0.0F;
+  }
+
+  pecrystalizer->group_mask = passthrough;
 }
 
 static void gst_pecrystalizer_process(GstPecrystalizer* pecrystalizer, GstBuffer* buffer) {
-  bool ebur_failed = false;
-  double range = 0.0;
   GstMapInfo map;
 
   gst_buffer_map(buffer, &map, GST_MAP_READWRITE);
@@ -778,192 +855,136 @@ static void gst_pecrystalizer_process(GstPecrystalizer* pecrystalizer, GstBuffer
   /* Measure loudness range before the processing. Rigorously speaking we should
      add the band_data arrays because we will delay output by 1 sample. But I
      think this sample will not affect the measruing that much.
+
+     The measurement is done in the analysis thread. Here the frames are only copied.
    */
 
   if (pecrystalizer->notify) {
-    ebur128_add_frames_float(pecrystalizer->ebur_state_before, data, pecrystalizer->nsamples);
-
-    if (EBUR128_SUCCESS != ebur128_loudness_range(pecrystalizer->ebur_state_before, &range)) {
-      ebur_failed = true;
-    } else {
-      pecrystalizer->range_before = static_cast<float>(range);
-    }
+    pecrystalizer->loudness->push(0U, data, pecrystalizer->nsamples);
   }
 
-  for (int n = 0; n < NBANDS; n++) {
-    memcpy(pecrystalizer->band_data[n].data(), data, map.size);
-
-    pecrystalizer->filters[n]->process(pecrystalizer->band_data[n].data());
-
-    /*
-      Later we will need to calculate the second derivative of each band. This
-      is done through the central difference method. In order to calculate
-      the derivative at the last elementsof the array we have to now the first
-      element of the next buffer. As we do not have this information the only
-      way to do this calculation is delaying the signal by 1 sample.
-    */
-
-    // last (R,L) becomes the first
-    std::rotate(pecrystalizer->band_data[n].rbegin(), pecrystalizer->band_data[n].rbegin() + 2,
-                pecrystalizer->band_data[n].rend());
-
-    if (!pecrystalizer->ready) {
-      /*pecrystalizer->band_data was rotated. Its first values are the
-        last ones from the original array. Now we save the last (R,L) values for
-        the next round
-      */
-      pecrystalizer->delayed_L[n] = pecrystalizer->band_data[n][0];
-      pecrystalizer->delayed_R[n] = pecrystalizer->band_data[n][1];
+  gst_pecrystalizer_pick_bands(pecrystalizer);
 
-      // first elements becomes silence
-      pecrystalizer->band_data[n][0] = 0.0F;
-      pecrystalizer->band_data[n][1] = 0.0F;
+  const auto* bands = pecrystalizer->bands;
 
-      pecrystalizer->last_L[n] = 0.0F;
-      pecrystalizer->last_R[n] = 0.0F;
+  /*
+    Muted bands are not filtered at all. Bands that are bypassed or that have zero intensity outside the aggressive
+    mode pass unchanged. The filter bank computes their sum at the cost of a single band.
+  */
 
-      if (n == NBANDS - 1) {
-        pecrystalizer->ready = true;
-      }
-    } else {
-      /*pecrystalizer->band_data was rotated. Its first values are the
-        last ones from the original array. we have to save them for the next
-        round.
-      */
-      float L = pecrystalizer->band_data[n][0];
-      float R = pecrystalizer->band_data[n][1];
-
-      /*the previously delayed (R,L) pair becomes the first element of this
-        round.
-       */
-      pecrystalizer->band_data[n][0] = pecrystalizer->delayed_L[n];
-      pecrystalizer->band_data[n][1] = pecrystalizer->delayed_R[n];
-
-      // saving the last (R,L) values for the next round
-      pecrystalizer->delayed_L[n] = L;
-      pecrystalizer->delayed_R[n] = R;
+  uint32_t muted = 0U, passthrough = 0U;
+
+  for (uint n = 0U; n < NBANDS; n++) {
+    if (bands->mute[n]) {
+      muted |= 1U << n;
+    } else if (bands->bypass[n] || (bands->intensities[n] == 0.0F && !pecrystalizer->aggressive)) {
+      passthrough |= 1U << n;
     }
   }
 
-  for (int n = 0; n < NBANDS; n++) {
-    if (!pecrystalizer->bypass[n]) {
-      // Calculating second derivative
-
-      for (uint m = 0U; m < pecrystalizer->nsamples; m++) {
-        float L = pecrystalizer->band_data[n][2U * m];
-        float R = pecrystalizer->band_data[n][2U * m + 1U];
-
-        if (m > 0U && m < pecrystalizer->nsamples - 1U) {
-          float L_lower = pecrystalizer->band_data[n][2U * (m - 1U)];
-          float R_lower = pecrystalizer->band_data[n][2U * (m - 1U) + 1U];
-          float L_upper = pecrystalizer->band_data[n][2U * (m + 1U)];
-          float R_upper = pecrystalizer->band_data[n][2U * (m + 1U) + 1U];
-
-          pecrystalizer->deriv2[2U * m] = L_upper - 2.0F * L + L_lower;
-          pecrystalizer->deriv2[2U * m + 1U] = R_upper - 2.0F * R + R_lower;
-        } else if (m == 0U) {
-          float L_upper = pecrystalizer->band_data[n][2U * (m + 1U)];
-          float R_upper = pecrystalizer->band_data[n][2U * (m + 1U) + 1U];
-
-          pecrystalizer->deriv2[2U * m] = L_upper - 2.0F * L + pecrystalizer->last_L[n];
-          pecrystalizer->deriv2[2U * m + 1U] = R_upper - 2.0F * R + pecrystalizer->last_R[n];
-        } else if (m == pecrystalizer->nsamples - 1U) {
-          float L_upper = pecrystalizer->delayed_L[n];
-          float R_upper = pecrystalizer->delayed_R[n];
-          float L_lower = pecrystalizer->band_data[n][2U * (m - 1U)];
-          float R_lower = pecrystalizer->band_data[n][2U * (m - 1U) + 1U];
-
-          pecrystalizer->deriv2[2U * m] = L_upper - 2.0F * L + L_lower;
-          pecrystalizer->deriv2[2U * m + 1U] = R_upper - 2.0F * R + R_lower;
-        }
-      }
+  if (pecrystalizer->crossover_mode == PECRYSTALIZER_CROSSOVER_LOW_LATENCY) {
+    // the crossovers are cascaded so the passthrough bands are still split one by one
 
-      // peak enhancing using second derivative
+    pecrystalizer->crossover->process(data, pecrystalizer->nsamples, pecrystalizer->band_data, muted);
+  } else {
+    // all the bands are computed from a single transform of the input
 
-      for (uint m = 0U; m < pecrystalizer->nsamples; m++) {
-        float L = pecrystalizer->band_data[n][2U * m];
-        float R = pecrystalizer->band_data[n][2U * m + 1];
-        float d2L = pecrystalizer->deriv2[2U * m];
-        float d2R = pecrystalizer->deriv2[2U * m + 1];
+    pecrystalizer->filterbank->process(data, pecrystalizer->band_data, muted, passthrough, pecrystalizer->group_data);
+  }
 
-        pecrystalizer->band_data[n][2U * m] = L - pecrystalizer->intensities[n] * d2L;
-        pecrystalizer->band_data[n][2U * m + 1U] = R - pecrystalizer->intensities[n] * d2R;
+  /*
+    Later we will need to calculate the second derivative of each band. This
+    is done through the central difference method. In order to calculate
+    the derivative at the last element of the array we have to know the first
+    element of the next buffer. As we do not have this information the only
+    way to do this calculation is delaying the signal by 1 sample.
+  */
 
-        /*
-          Aggressive mode applies a amplitude dependent gain to every sample in
-          the signal
-        */
+  uint nsamples = pecrystalizer->nsamples;
 
-        if (pecrystalizer->aggressive && pecrystalizer->gain[n].size() != 0U) {
-          uint idx_L = floorf(fabsf(L) / pecrystalizer->dv);
-          uint idx_R = floorf(fabsf(R) / pecrystalizer->dv);
+  float* out_L = pecrystalizer->output.data();
+  float* out_R = pecrystalizer->output.data() + nsamples;
 
-          if (idx_L < 0U) {
-            idx_L = 0U;
-          } else if (idx_L > pecrystalizer->gain[n].size()) {
-            idx_L = pecrystalizer->gain[n].size() - 1U;
-          }
+  std::fill(pecrystalizer->output.begin(), pecrystalizer->output.end(), 0.0F);
 
-          if (idx_R < 0U) {
-            idx_R = 0U;
-          } else if (idx_R > pecrystalizer->gain[n].size()) {
-            idx_R = pecrystalizer->gain[n].size() - 1U;
-          }
+  bool grouped = pecrystalizer->crossover_mode != PECRYSTALIZER_CROSSOVER_LOW_LATENCY;
 
-          float vL = pecrystalizer->band_data[n][2U * m];
-          float vR = pecrystalizer->band_data[n][2U * m + 1U];
+  if (grouped) {
+    gst_pecrystalizer_update_group(pecrystalizer, passthrough);
 
-          pecrystalizer->band_data[n][2U * m] = vL * pecrystalizer->gain[n][idx_L];
+    if (passthrough != 0U) {
+      const float* group_L = pecrystalizer->group_data.data();
+      const float* group_R = pecrystalizer->group_data.data() + nsamples;
 
-          pecrystalizer->band_data[n][2U * m + 1U] = vR * pecrystalizer->gain[n][idx_R];
-        }
+      gst_pecrystalizer_delay_band(group_L, out_L, nsamples, pecrystalizer->group_delayed_L,
+                                   pecrystalizer->group_last_L);
+      gst_pecrystalizer_delay_band(group_R, out_R, nsamples, pecrystalizer->group_delayed_R,
+                                   pecrystalizer->group_last_R);
+    } else if (nsamples > 0U) {
+      // the group became empty. Its delayed sample still belongs to the output
 
-        if (m == pecrystalizer->nsamples - 1U) {
-          pecrystalizer->last_L[n] = L;
-          pecrystalizer->last_R[n] = R;
-        }
+      out_L[0] += pecrystalizer->group_delayed_L;
+      out_R[0] += pecrystalizer->group_delayed_R;
+
+      pecrystalizer->group_last_L = pecrystalizer->group_last_R = 0.0F;
+      pecrystalizer->group_delayed_L = pecrystalizer->group_delayed_R = 0.0F;
+    }
+  }
+
+  for (int n = 0; n < NBANDS; n++) {
+    const float* band_L = pecrystalizer->band_data[n].data();
+    const float* band_R = pecrystalizer->band_data[n].data() + nsamples;
+
+    if ((muted & (1U << n)) != 0U) {
+      // this band was not computed. Its filters and its derivative start from silence when it is unmuted
+
+      pecrystalizer->delayed_L[n] = pecrystalizer->last_L[n] = 0.0F;
+      pecrystalizer->delayed_R[n] = pecrystalizer->last_R[n] = 0.0F;
+    } else if ((passthrough & (1U << n)) != 0U) {
+      if (!grouped) {
+        gst_pecrystalizer_delay_band(band_L, out_L, nsamples, pecrystalizer->delayed_L[n], pecrystalizer->last_L[n]);
+        gst_pecrystalizer_delay_band(band_R, out_R, nsamples, pecrystalizer->delayed_R[n], pecrystalizer->last_R[n]);
       }
+    } else if (pecrystalizer->aggressive && !bands->gain[n].empty()) {
+      const auto& gain = bands->gain[n];
+
+      gst_pecrystalizer_enhance_band<true>(band_L, out_L, nsamples, bands->intensities[n], gain.data(),
+                                           gain.size(), pecrystalizer->dv, pecrystalizer->delayed_L[n],
+                                           pecrystalizer->last_L[n]);
+      gst_pecrystalizer_enhance_band<true>(band_R, out_R, nsamples, bands->intensities[n], gain.data(),
+                                           gain.size(), pecrystalizer->dv, pecrystalizer->delayed_R[n],
+                                           pecrystalizer->last_R[n]);
     } else {
-      pecrystalizer->last_L[n] = pecrystalizer->band_data[n][2U * pecrystalizer->nsamples - 2U];
-      pecrystalizer->last_R[n] = pecrystalizer->band_data[n][2U * pecrystalizer->nsamples - 1U];
+      gst_pecrystalizer_enhance_band<false>(band_L, out_L, nsamples, bands->intensities[n], nullptr, 0U,
+                                            pecrystalizer->dv, pecrystalizer->delayed_L[n], pecrystalizer->last_L[n]);
+      gst_pecrystalizer_enhance_band<false>(band_R, out_R, nsamples, bands->intensities[n], nullptr, 0U,
+                                            pecrystalizer->dv, pecrystalizer->delayed_R[n], pecrystalizer->last_R[n]);
     }
   }
 
-  // add bands
-
-  for (uint n = 0U; n < 2U * pecrystalizer->nsamples; n++) {
-    data[n] = 0.0F;
+  // interleave
 
-    for (uint m = 0U; m < pecrystalizer->filters.size(); m++) {
-      if (!pecrystalizer->mute[m]) {
-        data[n] += pecrystalizer->band_data[m][n];
-      }
-    }
+  for (uint n = 0U; n < nsamples; n++) {
+    data[2U * n] = out_L[n];
+    data[2U * n + 1U] = out_R[n];
   }
 
   // Measure loudness range after the processing
 
   if (pecrystalizer->notify) {
-    ebur128_add_frames_float(pecrystalizer->ebur_state_after, data, pecrystalizer->nsamples);
-
-    if (EBUR128_SUCCESS != ebur128_loudness_range(pecrystalizer->ebur_state_after, &range)) {
-      ebur_failed = true;
-    } else {
-      pecrystalizer->range_after = static_cast<float>(range);
-    }
+    pecrystalizer->loudness->push(1U, data, pecrystalizer->nsamples);
   }
 
   gst_buffer_unmap(buffer, &map);
 
-  if (!ebur_failed && pecrystalizer->notify) {
+  // the values notified are the last ones published by the analysis thread
+
+  if (pecrystalizer->notify) {
     pecrystalizer->sample_count += pecrystalizer->nsamples;
 
     if (pecrystalizer->sample_count >= pecrystalizer->notify_samples) {
       pecrystalizer->sample_count = 0;
 
-      // std::cout << "range: " << pecrystalizer->range_before << "\t"
-      //           << pecrystalizer->range_after << std::endl;
-
       g_object_notify(G_OBJECT(pecrystalizer), "lra-before");
       g_object_notify(G_OBJECT(pecrystalizer), "lra-after");
     }
@@ -986,9 +1007,12 @@ static gboolean gst_pecrystalizer_src_query(GstPad* pad, GstObject* parent, GstQ
 
           gst_query_parse_latency(query, &live, &min, &max);
 
-          /* add our own latency */
+          /*
+            add our own latency: the delay of the band filters plus 1 sample for the second derivative. The
+            buffering done by the peadapter in front of us is reported by the peadapter itself.
+          */
 
-          latency = gst_util_uint64_scale_round(1UL, GST_SECOND, pecrystalizer->rate);
+          latency = gst_util_uint64_scale_round(pecrystalizer->latency + 1UL, GST_SECOND, pecrystalizer->rate);
 
           // std::cout << "latency: " << latency << std::endl;
           // std::cout << "n: " << pecrystalizer->inbuf_n_samples
@@ -1023,20 +1047,48 @@ static gboolean gst_pecrystalizer_src_query(GstPad* pad, GstObject* parent, GstQ
 }
 
 static void gst_pecrystalizer_finish_filters(GstPecrystalizer* pecrystalizer) {
-  pecrystalizer->ready = false;
+  // the one sample delay of the bands starts from silence
 
-  for (int m = 0; m < NBANDS; m++) {
-    pecrystalizer->filters[m]->finish();
-  }
+  pecrystalizer->last_L.fill(0.0F);
+  pecrystalizer->last_R.fill(0.0F);
+  pecrystalizer->delayed_L.fill(0.0F);
+  pecrystalizer->delayed_R.fill(0.0F);
+
+  pecrystalizer->group_last_L = pecrystalizer->group_last_R = 0.0F;
+  pecrystalizer->group_delayed_L = pecrystalizer->group_delayed_R = 0.0F;
+  pecrystalizer->group_mask = 0U;
+
+  pecrystalizer->filterbank->finish();
+  pecrystalizer->crossover->finish();
+}
+
+/*
+  Called with bands_mutex locked from the thread that set the properties. The gain tables are computed there and
+  the streaming thread only swaps pointers. A block that was never picked is replaced. The block retired by the
+  streaming thread is freed here because freeing memory there could block.
+*/
+
+static void gst_pecrystalizer_publish_bands(GstPecrystalizer* pecrystalizer) {
+  auto* block = new PecrystalizerBands(pecrystalizer->bands_params);
+
+  delete pecrystalizer->retired_bands.exchange(nullptr);
 
-  if (pecrystalizer->ebur_state_before != nullptr) {
-    ebur128_destroy(&pecrystalizer->ebur_state_before);
-    pecrystalizer->ebur_state_before = nullptr;
+  delete pecrystalizer->next_bands.exchange(block);
+}
+
+static void gst_pecrystalizer_pick_bands(GstPecrystalizer* pecrystalizer) {
+  // the previous block has to be freed before another one can be retired
+
+  if (pecrystalizer->retired_bands.load() != nullptr) {
+    return;
   }
 
-  if (pecrystalizer->ebur_state_after != nullptr) {
-    ebur128_destroy(&pecrystalizer->ebur_state_after);
-    pecrystalizer->ebur_state_after = nullptr;
+  auto* block = pecrystalizer->next_bands.exchange(nullptr);
+
+  if (block != nullptr) {
+    pecrystalizer->retired_bands.store(pecrystalizer->bands);
+
+    pecrystalizer->bands = block;
   }
 }
 
@@ -1049,6 +1101,20 @@ void gst_pecrystalizer_finalize(GObject* object) {
 
   gst_pecrystalizer_finish_filters(pecrystalizer);
 
+  delete pecrystalizer->filterbank;
+  delete pecrystalizer->crossover;
+  delete pecrystalizer->loudness;
+
+  pecrystalizer->filterbank = nullptr;
+  pecrystalizer->crossover = nullptr;
+  pecrystalizer->loudness = nullptr;
+
+  delete pecrystalizer->bands;
+  delete pecrystalizer->next_bands.exchange(nullptr);
+  delete pecrystalizer->retired_bands.exchange(nullptr);
+
+  pecrystalizer->bands = nullptr;
+
   /* clean up object here */
 
   G_OBJECT_CLASS(gst_pecrystalizer_parent_class)->finalize(object);
@@ -20,11 +20,15 @@
 #ifndef GST_PECRYSTALIZER_HPP
 #define GST_PECRYSTALIZER_HPP
 
-#include <ebur128.h>
 #include <gst/audio/gstaudiofilter.h>
 #include <array>
+#include <atomic>
 #include <mutex>
+#include <vector>
+#include "crossover.hpp"
 #include "filter.hpp"
+#include "filterbank.hpp"
+#include "loudness_analyzer.hpp"
 
 G_BEGIN_DECLS
 
@@ -39,36 +43,70 @@ typedef struct _GstPecrystalizerClass GstPecrystalizerClass;
 
 #define NBANDS 13
 
+/*
+  The linear phase bands are long FIR filters. The low latency ones are IIR crossovers that do not delay the signal
+  but change its phase. The minimum phase bands are the linear phase kernels converted to minimum phase. Their delay
+  is much smaller but it depends on the frequency.
+*/
+
+enum GstPecrystalizerCrossover {
+  PECRYSTALIZER_CROSSOVER_LINEAR_PHASE,
+  PECRYSTALIZER_CROSSOVER_LOW_LATENCY,
+  PECRYSTALIZER_CROSSOVER_MINIMUM_PHASE
+};
+
+/*
+  Settings of all the bands. Every change makes a new block with the aggressive mode gain tables already computed.
+  It is handed to the streaming thread with a single pointer swap.
+*/
+
+struct PecrystalizerBands {
+  std::array<float, NBANDS> intensities;
+  std::array<bool, NBANDS> mute, bypass;
+  std::array<std::vector<float>, NBANDS> gain;
+};
+
 struct _GstPecrystalizer {
   GstAudioFilter base_pecrystalizer;
 
   /* properties */
 
   std::array<float, NBANDS - 1> freqs;
-  std::array<float, NBANDS> intensities;
-  std::array<bool, NBANDS> mute, bypass;
+  PecrystalizerBands bands_params;  // values last set. Protected by bands_mutex
 
-  float range_before, range_after;  // loudness range
+  int crossover_mode;  // see GstPecrystalizerCrossover
 
   /* < private > */
 
-  bool ready, notify, aggressive;
+  bool notify, aggressive;
   int rate, bpf;  // sampling rate,  bytes per frame : channels * bps
   uint nsamples;
+  uint latency;  // delay of the band filters in frames. It does not include the 1 sample of the derivative
   int notify_samples;  // number of samples to count before emit a notify
   int sample_count;
   uint ndivs;
   float dv;
 
-  std::array<Filter*, NBANDS> filters;
-  std::array<std::vector<float>, NBANDS> band_data, gain;
-  std::array<float, NBANDS> last_L, last_R, delayed_L, delayed_R;
+  Filterbank* filterbank;  // used in the linear phase mode
+  Crossover* crossover;    // used in the low latency mode
 
-  std::vector<float> deriv2;
+  std::vector<std::vector<float>> band_data;  // output of each band. Planar
+  std::array<float, NBANDS> last_L, last_R, delayed_L, delayed_R;  // one sample delay of each band
 
-  ebur128_state *ebur_state_before, *ebur_state_after;
+  std::vector<float> output;  // sum of the enhanced bands. Planar
+
+  std::vector<float> group_data;  // sum of the bands that pass unchanged. Planar
+  float group_last_L, group_last_R, group_delayed_L, group_delayed_R;
+  uint32_t group_mask;  // bands in the group in the previous buffer
+
+  LoudnessAnalyzer* loudness;  // tap 0 is the crystalizer input and tap 1 its output
 
   std::mutex mutex;
+  std::mutex bands_mutex;
+
+  PecrystalizerBands* bands;                       // used by the streaming thread
+  std::atomic<PecrystalizerBands*> next_bands;     // waiting to be picked by the streaming thread
+  std::atomic<PecrystalizerBands*> retired_bands;  // swapped out by the streaming thread. Freed by the next update
 
   GstPad *srcpad = nullptr, *sinkpad = nullptr;
 };
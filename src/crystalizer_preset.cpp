@@ -30,6 +30,8 @@ void CrystalizerPreset::save(boost::property_tree::ptree& root,
 
   root.put(section + ".crystalizer.aggressive", settings->get_boolean("aggressive"));
 
+  root.put(section + ".crystalizer.crossover", settings->get_string("crossover"));
+
   root.put(section + ".crystalizer.input-gain", settings->get_double("input-gain"));
 
   root.put(section + ".crystalizer.output-gain", settings->get_double("output-gain"));
@@ -53,6 +55,8 @@ void CrystalizerPreset::load(const boost::property_tree::ptree& root,
 
   update_key<bool>(root, settings, "aggressive", section + ".crystalizer.aggressive");
 
+  update_string_key(root, settings, "crossover", section + ".crystalizer.crossover");
+
   update_key<double>(root, settings, "input-gain", section + ".crystalizer.input-gain");
 
   update_key<double>(root, settings, "output-gain", section + ".crystalizer.output-gain");
@@ -18,6 +18,43 @@
  */
 
 #include "crystalizer_ui.hpp"
+#include <cstring>
+
+namespace {
+
+auto crossover_enum_to_int(GValue* value, GVariant* variant, gpointer user_data) -> gboolean {
+  const auto* v = g_variant_get_string(variant, nullptr);
+
+  if (std::strcmp(v, "linear-phase") == 0) {
+    g_value_set_int(value, 0);
+  } else if (std::strcmp(v, "low-latency") == 0) {
+    g_value_set_int(value, 1);
+  } else if (std::strcmp(v, "minimum-phase") == 0) {
+    g_value_set_int(value, 2);
+  }
+
+  return 1;
+}
+
+auto int_to_crossover_enum(const GValue* value, const GVariantType* expected_type, gpointer user_data) -> GVariant* {
+  const auto v = g_value_get_int(value);
+
+  switch (v) {
+    case 0:
+      return g_variant_new_string("linear-phase");
+
+    case 1:
+      return g_variant_new_string("low-latency");
+
+    case 2:
+      return g_variant_new_string("minimum-phase");
+
+    default:
+      return g_variant_new_string("linear-phase");
+  }
+}
+
+}  // namespace
 
 CrystalizerUi::CrystalizerUi(BaseObjectType* cobject,
                              const Glib::RefPtr<Gtk::Builder>& builder,
@@ -34,6 +71,7 @@ CrystalizerUi::CrystalizerUi(BaseObjectType* cobject,
   builder->get_widget("range_before_label", range_before_label);
   builder->get_widget("range_after_label", range_after_label);
   builder->get_widget("aggressive", aggressive);
+  builder->get_widget("crossover", crossover);
   builder->get_widget("plugin_reset", reset_button);
 
   get_object(builder, "input_gain", input_gain);
@@ -49,6 +87,9 @@ CrystalizerUi::CrystalizerUi(BaseObjectType* cobject,
   settings->bind("output-gain", output_gain.get(), "value", flag);
   settings->bind("aggressive", aggressive, "active", flag);
 
+  g_settings_bind_with_mapping(settings->gobj(), "crossover", crossover->gobj(), "active", G_SETTINGS_BIND_DEFAULT,
+                               crossover_enum_to_int, int_to_crossover_enum, nullptr, nullptr);
+
   build_bands(13);
 
   // reset plugin
@@ -62,6 +103,8 @@ CrystalizerUi::~CrystalizerUi() {
 void CrystalizerUi::reset() {
   settings->reset("aggressive");
 
+  settings->reset("crossover");
+
   settings->reset("input-gain");
 
   settings->reset("output-gain");
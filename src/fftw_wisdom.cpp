@@ -0,0 +1,162 @@
+/*
+ *  Copyright © 2017-2020 Wellington Wallace
+ *
+ *  This file is part of PulseEffects.
+ *
+ *  PulseEffects is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  PulseEffects is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with PulseEffects.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "fftw_wisdom.hpp"
+#include <fftw3.h>
+#include <glib.h>
+#include <unistd.h>
+#include <cstdio>
+#include <mutex>
+#include "util.hpp"
+
+namespace {
+
+const std::string log_tag = "fftw_wisdom: ";
+
+/*
+  zita uses partitions from the quantum up to Convproc::MAXPART. Each partition of size p is transformed with a real
+  fft of size 2 * p in both directions.
+*/
+
+constexpr int min_partition = 64;
+constexpr int max_partition = 8192;
+
+std::once_flag load_flag;
+
+}  // namespace
+
+namespace fftw_wisdom {
+
+auto get_wisdom_file() -> std::string {
+  return std::string(g_get_user_cache_dir()) + "/PulseEffects/fftwf_wisdom";
+}
+
+auto wisdom_file_exists() -> bool {
+  return g_file_test(get_wisdom_file().c_str(), G_FILE_TEST_IS_REGULAR) != 0;
+}
+
+auto generation_attempted() -> bool {
+  return g_file_test((get_wisdom_file() + ".attempted").c_str(), G_FILE_TEST_EXISTS) != 0;
+}
+
+void mark_generation_attempt() {
+  auto dir = std::string(g_get_user_cache_dir()) + "/PulseEffects";
+
+  if (g_mkdir_with_parents(dir.c_str(), 0755) != 0 ||
+      g_file_set_contents((get_wisdom_file() + ".attempted").c_str(), "", 0, nullptr) == 0) {
+    util::warning(log_tag + "could not record the wisdom generation attempt");
+  }
+}
+
+void load() {
+  std::call_once(load_flag, []() {
+    /*
+      The plugins and zita share the fftw library and plan from their own threads. The planner itself serializes the
+      plans made by every thread in the process.
+    */
+
+    fftwf_make_planner_thread_safe();
+
+    auto path = get_wisdom_file();
+
+    if (!wisdom_file_exists()) {
+      util::debug(log_tag + "there is no wisdom file. Using estimated fftw plans");
+
+      return;
+    }
+
+    if (fftwf_import_wisdom_from_filename(path.c_str()) != 0) {
+      util::debug(log_tag + "imported wisdom from " + path);
+    } else {
+      util::warning(log_tag + "could not import wisdom from " + path);
+    }
+  });
+}
+
+auto generate() -> bool {
+  auto path = get_wisdom_file();
+  auto dir = std::string(g_get_user_cache_dir()) + "/PulseEffects";
+
+  if (g_mkdir_with_parents(dir.c_str(), 0755) != 0) {
+    util::warning(log_tag + "could not create the directory " + dir);
+
+    return false;
+  }
+
+  // keeping what was measured before so that generating again is fast
+
+  fftwf_import_wisdom_from_filename(path.c_str());
+
+  for (int p = min_partition; p <= max_partition; p *= 2) {
+    int size = 2 * p;
+
+    util::info(log_tag + "measuring fft plans of size " + std::to_string(size));
+
+    // like zita we use out of place transforms between buffers allocated by fftw
+
+    auto* time_data = fftwf_alloc_real(size);
+    auto* freq_data = fftwf_alloc_complex(p + 1);
+
+    fftwf_plan r2c = fftwf_plan_dft_r2c_1d(size, time_data, freq_data, FFTW_MEASURE);
+    fftwf_plan c2r = fftwf_plan_dft_c2r_1d(size, freq_data, time_data, FFTW_MEASURE);
+
+    fftwf_destroy_plan(r2c);
+    fftwf_destroy_plan(c2r);
+
+    fftwf_free(time_data);
+    fftwf_free(freq_data);
+  }
+
+  /*
+    Writing to a temporary file first so that a running instance never imports a partial file. Its name is unique so
+    that two generators running at the same time do not write to the same file.
+  */
+
+  auto tmp_path = path + ".XXXXXX";
+
+  int fd = g_mkstemp(tmp_path.data());
+
+  FILE* f = (fd < 0) ? nullptr : fdopen(fd, "w");
+
+  bool ok = f != nullptr;
+
+  if (ok) {
+    fftwf_export_wisdom_to_file(f);
+
+    ok = fclose(f) == 0;
+  } else if (fd >= 0) {
+    close(fd);
+  }
+
+  if (!ok || std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+    util::warning(log_tag + "could not save the wisdom file " + path);
+
+    if (fd >= 0) {
+      std::remove(tmp_path.c_str());
+    }
+
+    return false;
+  }
+
+  util::info(log_tag + "wisdom saved to " + path);
+
+  return true;
+}
+
+}  // namespace fftw_wisdom
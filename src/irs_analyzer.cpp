@@ -0,0 +1,518 @@
+/*
+ *  Copyright © 2017-2020 Wellington Wallace
+ *
+ *  This file is part of PulseEffects.
+ *
+ *  PulseEffects is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  PulseEffects is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with PulseEffects.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "irs_analyzer.hpp"
+#include <glib.h>
+#include <gst/fft/gstfftf32.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sndfile.hh>
+#include <utility>
+#include "file_cache.hpp"
+#include "util.hpp"
+
+namespace {
+
+constexpr char cache_magic[8] = {'P', 'E', 'I', 'R', 'S', 'A', 'N', 'L'};
+constexpr uint32_t cache_version = 2U;
+constexpr uint64_t max_cache_size = 32U * 1024U * 1024U;  // bytes
+constexpr size_t max_memory_entries = 64U;
+
+auto get_mtime(const std::string& path, int64_t& mtime) -> bool {
+  struct stat st {};
+
+  if (stat(path.c_str(), &st) != 0) {
+    return false;
+  }
+
+  mtime = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+
+  return true;
+}
+
+template <typename T>
+auto write_value(FILE* f, const T& v) -> bool {
+  return fwrite(&v, sizeof(T), 1, f) == 1;
+}
+
+template <typename T>
+auto read_value(std::ifstream& f, T& v) -> bool {
+  return static_cast<bool>(f.read(reinterpret_cast<char*>(&v), sizeof(T)));
+}
+
+auto write_vector(FILE* f, const std::vector<float>& v) -> bool {
+  return write_value(f, static_cast<uint32_t>(v.size())) && fwrite(v.data(), sizeof(float), v.size(), f) == v.size();
+}
+
+auto read_vector(std::ifstream& f, std::vector<float>& v, const uint& max_size) -> bool {
+  uint32_t size = 0U;
+
+  if (!read_value(f, size) || size > max_size) {
+    return false;
+  }
+
+  v.resize(size);
+
+  return static_cast<bool>(f.read(reinterpret_cast<char*>(v.data()), size * sizeof(float)));
+}
+
+// rescaling between 0 and 1
+
+void normalize(std::vector<float>& v, const float& min_v, const float& max_v) {
+  float range = max_v - min_v;
+
+  for (auto& value : v) {
+    value = (range > 0.0F) ? (value - min_v) / range : 0.0F;
+  }
+}
+
+}  // namespace
+
+IrsAnalyzer::IrsAnalyzer(const uint& max_points, std::function<void()> notify)
+    : max_points(max_points), notify(std::move(notify)), worker([this]() { work(); }) {}
+
+IrsAnalyzer::~IrsAnalyzer() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    quit = true;
+  }
+
+  cv.notify_one();
+
+  worker.join();
+
+  util::debug(log_tag + "destroyed");
+}
+
+auto IrsAnalyzer::lookup(const std::string& path) -> std::shared_ptr<const IrsAnalysis> {
+  int64_t mtime = 0;
+
+  if (!get_mtime(path, mtime)) {
+    return nullptr;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex);
+
+  return find_cached(path, mtime);
+}
+
+auto IrsAnalyzer::find_cached(const std::string& path, const int64_t& mtime) -> std::shared_ptr<const IrsAnalysis> {
+  auto it = cache.find(path);
+
+  if (it == cache.end() || it->second.analysis->mtime != mtime) {
+    return nullptr;
+  }
+
+  it->second.last_use = ++use_count;
+
+  return it->second.analysis;
+}
+
+// when the memory cache is full the entry that was not used for the longest time makes room for the new one
+
+void IrsAnalyzer::store_cached(const std::string& path, const std::shared_ptr<const IrsAnalysis>& analysis) {
+  if (cache.find(path) == cache.end() && cache.size() >= max_memory_entries) {
+    auto oldest = std::min_element(cache.begin(), cache.end(), [](const auto& a, const auto& b) {
+      return a.second.last_use < b.second.last_use;
+    });
+
+    cache.erase(oldest);
+  }
+
+  cache[path] = CacheEntry{analysis, ++use_count};
+}
+
+auto IrsAnalyzer::take_results() -> std::vector<std::pair<std::string, std::shared_ptr<const IrsAnalysis>>> {
+  std::lock_guard<std::mutex> lock(mutex);
+
+  return std::move(results);
+}
+
+void IrsAnalyzer::request(const std::string& path, const bool& urgent) {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if (urgent) {
+      urgent_path = path;
+    } else if (std::find(queue.begin(), queue.end(), path) == queue.end()) {
+      queue.emplace_back(path);
+    }
+  }
+
+  cv.notify_one();
+}
+
+void IrsAnalyzer::work() {
+  while (true) {
+    std::string path;
+
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+
+      cv.wait(lock, [this]() { return quit || !urgent_path.empty() || !queue.empty(); });
+
+      if (quit) {
+        return;
+      }
+
+      if (!urgent_path.empty()) {
+        path = urgent_path;
+
+        urgent_path.clear();
+      } else {
+        path = queue.front();
+
+        queue.pop_front();
+      }
+    }
+
+    int64_t mtime = 0;
+    std::shared_ptr<const IrsAnalysis> analysis;
+
+    if (get_mtime(path, mtime)) {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        analysis = find_cached(path, mtime);
+      }
+
+      if (analysis == nullptr) {
+        analysis = load_from_disk(path, mtime);
+      }
+
+      if (analysis == nullptr) {
+        auto result = analyze(path, mtime);
+
+        if (result != nullptr) {
+          save_to_disk(path, *result);
+        }
+
+        analysis = result;
+      }
+
+      if (analysis != nullptr) {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        store_cached(path, analysis);
+      }
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+
+      results.emplace_back(path, analysis);
+    }
+
+    notify();
+  }
+}
+
+auto IrsAnalyzer::analyze(const std::string& path, const int64_t& mtime) -> std::shared_ptr<IrsAnalysis> {
+  SndfileHandle file = SndfileHandle(path);
+
+  uint channels = file.channels();
+
+  if ((channels != 1U && channels != 2U && channels != 4U) || file.frames() == 0) {
+    util::debug(log_tag + "could not analyze " + path);
+
+    return nullptr;
+  }
+
+  util::debug(log_tag + "analyzing " + path);
+
+  auto analysis = std::make_shared<IrsAnalysis>();
+
+  analysis->mtime = mtime;
+  analysis->rate = file.samplerate();
+  analysis->channels = channels;
+  analysis->frames = file.frames();
+  analysis->duration = (static_cast<float>(analysis->frames) - 1.0F) / static_cast<float>(analysis->rate);
+
+  std::vector<float> kernel(channels * analysis->frames);
+
+  file.readf(kernel.data(), analysis->frames);
+
+  /*
+    For true stereo files we show what each output gets when the same signal is fed to both inputs. The channels are
+    in the order LL, LR, RL, RR.
+  */
+
+  std::vector<float> left(analysis->frames), right(analysis->frames);
+
+  for (uint n = 0U; n < analysis->frames; n++) {
+    switch (channels) {
+      case 1U:
+        left[n] = kernel[n];
+        right[n] = kernel[n];
+        break;
+      case 2U:
+        left[n] = kernel[2U * n];
+        right[n] = kernel[2U * n + 1U];
+        break;
+      default:
+        left[n] = kernel[4U * n] + kernel[4U * n + 2U];
+        right[n] = kernel[4U * n + 1U] + kernel[4U * n + 3U];
+        break;
+    }
+  }
+
+  // waveform
+
+  get_envelope(left, analysis->left_mag, analysis->min_left, analysis->max_left);
+  get_envelope(right, analysis->right_mag, analysis->min_right, analysis->max_right);
+
+  uint n_columns = analysis->left_mag.size() / 2U;
+  float column_dt = analysis->duration / static_cast<float>(n_columns);
+
+  analysis->time_axis.resize(analysis->left_mag.size());
+
+  for (uint n = 0U; n < analysis->time_axis.size(); n++) {
+    analysis->time_axis[n] = static_cast<float>(n / 2U) * column_dt;
+  }
+
+  // energy decay curve used to show how much of the kernel the convolver keeps
+
+  get_edc(kernel, channels, n_columns, analysis->edc);
+
+  // spectrum
+
+  analysis->fft_min_freq = 1.0F;
+  analysis->fft_max_freq = 0.5F * static_cast<float>(analysis->rate);
+
+  analysis->freq_axis = util::logspace(log10(analysis->fft_min_freq), log10(analysis->fft_max_freq), max_points);
+
+  get_spectrum(left, analysis->rate, analysis->freq_axis, analysis->left_spectrum, analysis->fft_min_left,
+               analysis->fft_max_left);
+  get_spectrum(right, analysis->rate, analysis->freq_axis, analysis->right_spectrum, analysis->fft_min_right,
+               analysis->fft_max_right);
+
+  return analysis;
+}
+
+/*
+  Instead of interpolating the waveform we keep the minimum and the maximum of the samples under each plot column.
+  This is linear in the file size and does not hide peaks.
+*/
+
+void IrsAnalyzer::get_envelope(const std::vector<float>& signal,
+                               std::vector<float>& envelope,
+                               float& min_v,
+                               float& max_v) {
+  uint n_columns = std::min(static_cast<uint>(signal.size()), max_points);
+
+  envelope.resize(2U * n_columns);
+
+  for (uint c = 0U; c < n_columns; c++) {
+    size_t start = c * signal.size() / n_columns;
+    size_t end = std::max(start + 1U, (c + 1U) * signal.size() / n_columns);
+
+    auto [lo, hi] = std::minmax_element(signal.begin() + start, signal.begin() + end);
+
+    envelope[2U * c] = *lo;
+    envelope[2U * c + 1U] = *hi;
+  }
+
+  min_v = *std::min_element(envelope.begin(), envelope.end());
+  max_v = *std::max_element(envelope.begin(), envelope.end());
+
+  normalize(envelope, min_v, max_v);
+}
+
+/*
+  Schroeder backward integration of the energy of all channels, the same curve the convolver uses to trim the tail
+  of the kernel. It is sampled at the first frame of each plot column.
+*/
+
+void IrsAnalyzer::get_edc(const std::vector<float>& kernel,
+                          const uint& channels,
+                          const uint& n_columns,
+                          std::vector<float>& edc) {
+  size_t frames = kernel.size() / channels;
+
+  std::vector<double> tail(frames + 1U, 0.0);
+
+  for (size_t n = frames; n > 0U; n--) {
+    double e = 0.0;
+
+    for (uint c = 0U; c < channels; c++) {
+      e += static_cast<double>(kernel[(n - 1U) * channels + c]) * kernel[(n - 1U) * channels + c];
+    }
+
+    tail[n - 1U] = tail[n] + e;
+  }
+
+  edc.resize(n_columns);
+
+  for (uint c = 0U; c < n_columns; c++) {
+    double v = tail[c * frames / n_columns];
+
+    edc[c] = (tail[0] > 0.0 && v > 0.0) ? static_cast<float>(10.0 * log10(v / tail[0])) : -1000.0F;
+  }
+}
+
+/*
+  Each point of the logarithmic axis gets the largest magnitude of the fft bins between it and the next point. At
+  low frequencies there may be no bin in this range and we interpolate between the two closest ones.
+*/
+
+void IrsAnalyzer::get_spectrum(const std::vector<float>& signal,
+                               const uint& rate,
+                               const std::vector<float>& freq_axis,
+                               std::vector<float>& spectrum,
+                               float& min_v,
+                               float& max_v) {
+  // gstreamer real ffts need an even size. Padding with zeros to a size it can compute fast
+
+  uint nfft = gst_fft_next_fast_length(signal.size());
+
+  while (nfft % 2U != 0U) {
+    nfft = gst_fft_next_fast_length(nfft + 1U);
+  }
+
+  std::vector<float> tmp(nfft, 0.0F);
+
+  std::copy(signal.begin(), signal.end(), tmp.begin());
+
+  uint nbins = nfft / 2U + 1U;
+
+  GstFFTF32* fft_ctx = gst_fft_f32_new(nfft, 0);
+  auto* freqdata = g_new0(GstFFTF32Complex, nbins);
+
+  gst_fft_f32_fft(fft_ctx, tmp.data(), freqdata);
+
+  std::vector<float> mag(nbins);
+
+  for (uint i = 0U; i < nbins; i++) {
+    mag[i] = std::sqrt(freqdata[i].r * freqdata[i].r + freqdata[i].i * freqdata[i].i);
+  }
+
+  gst_fft_f32_free(fft_ctx);
+  g_free(freqdata);
+
+  float df = static_cast<float>(rate) / static_cast<float>(nfft);
+
+  spectrum.resize(freq_axis.size());
+
+  for (uint n = 0U; n < freq_axis.size(); n++) {
+    float f0 = freq_axis[n] / df;
+    float f1 = (n + 1U < freq_axis.size()) ? freq_axis[n + 1U] / df : f0 + 1.0F;
+
+    auto k0 = static_cast<uint>(std::ceil(f0));
+    auto k1 = std::min(static_cast<uint>(std::ceil(f1)), nbins);
+
+    if (k0 < k1) {
+      spectrum[n] = *std::max_element(mag.begin() + k0, mag.begin() + k1);
+    } else {
+      auto k = std::min(static_cast<uint>(f0), nbins - 2U);
+      float frac = std::min(f0 - static_cast<float>(k), 1.0F);
+
+      spectrum[n] = (1.0F - frac) * mag[k] + frac * mag[k + 1U];
+    }
+  }
+
+  min_v = *std::min_element(spectrum.begin(), spectrum.end());
+  max_v = *std::max_element(spectrum.begin(), spectrum.end());
+
+  normalize(spectrum, min_v, max_v);
+}
+
+auto IrsAnalyzer::get_cache_file(const std::string& path) -> std::string {
+  return file_cache::get_file("irs_analysis", path, ".bin");
+}
+
+auto IrsAnalyzer::load_from_disk(const std::string& path, const int64_t& mtime) -> std::shared_ptr<IrsAnalysis> {
+  std::ifstream f(get_cache_file(path), std::ios::binary);
+
+  if (!f.is_open()) {
+    return nullptr;
+  }
+
+  char magic[8];
+  uint32_t version = 0U, path_size = 0U;
+
+  f.read(magic, sizeof(magic));
+
+  if (!f || std::memcmp(magic, cache_magic, sizeof(magic)) != 0 || !read_value(f, version) ||
+      version != cache_version || !read_value(f, path_size) || path_size != path.size()) {
+    return nullptr;
+  }
+
+  std::string stored_path(path_size, '\0');
+
+  if (!f.read(stored_path.data(), path_size) || stored_path != path) {
+    return nullptr;
+  }
+
+  auto analysis = std::make_shared<IrsAnalysis>();
+
+  bool ok = read_value(f, analysis->mtime) && analysis->mtime == mtime && read_value(f, analysis->rate) &&
+            read_value(f, analysis->channels) && read_value(f, analysis->frames) &&
+            read_value(f, analysis->duration) && read_value(f, analysis->min_left) &&
+            read_value(f, analysis->max_left) && read_value(f, analysis->min_right) &&
+            read_value(f, analysis->max_right) && read_value(f, analysis->fft_min_left) &&
+            read_value(f, analysis->fft_max_left) && read_value(f, analysis->fft_min_right) &&
+            read_value(f, analysis->fft_max_right) && read_value(f, analysis->fft_min_freq) &&
+            read_value(f, analysis->fft_max_freq) && read_vector(f, analysis->time_axis, 2U * max_points) &&
+            read_vector(f, analysis->left_mag, 2U * max_points) &&
+            read_vector(f, analysis->right_mag, 2U * max_points) &&
+            read_vector(f, analysis->freq_axis, 2U * max_points) &&
+            read_vector(f, analysis->left_spectrum, 2U * max_points) &&
+            read_vector(f, analysis->right_spectrum, 2U * max_points) &&
+            read_vector(f, analysis->edc, 2U * max_points);
+
+  if (!ok || analysis->left_mag.empty() || analysis->left_spectrum.empty()) {
+    return nullptr;
+  }
+
+  file_cache::touch(get_cache_file(path));
+
+  util::debug(log_tag + "loaded the analysis of " + path + " from the cache");
+
+  return analysis;
+}
+
+void IrsAnalyzer::save_to_disk(const std::string& path, const IrsAnalysis& analysis) {
+  bool saved = file_cache::write("irs_analysis", get_cache_file(path), [&](FILE* f) {
+    bool ok = fwrite(cache_magic, sizeof(cache_magic), 1, f) == 1 && write_value(f, cache_version) &&
+              write_value(f, static_cast<uint32_t>(path.size())) &&
+              fwrite(path.c_str(), 1, path.size(), f) == path.size();
+
+    ok = ok && write_value(f, analysis.mtime) && write_value(f, analysis.rate) && write_value(f, analysis.channels) &&
+         write_value(f, analysis.frames) && write_value(f, analysis.duration) && write_value(f, analysis.min_left) &&
+         write_value(f, analysis.max_left) && write_value(f, analysis.min_right) &&
+         write_value(f, analysis.max_right) && write_value(f, analysis.fft_min_left) &&
+         write_value(f, analysis.fft_max_left) && write_value(f, analysis.fft_min_right) &&
+         write_value(f, analysis.fft_max_right) && write_value(f, analysis.fft_min_freq) &&
+         write_value(f, analysis.fft_max_freq);
+
+    return ok && write_vector(f, analysis.time_axis) && write_vector(f, analysis.left_mag) &&
+           write_vector(f, analysis.right_mag) && write_vector(f, analysis.freq_axis) &&
+           write_vector(f, analysis.left_spectrum) && write_vector(f, analysis.right_spectrum) &&
+           write_vector(f, analysis.edc);
+  });
+
+  if (saved) {
+    file_cache::trim("irs_analysis", ".bin", max_cache_size);
+  }
+}
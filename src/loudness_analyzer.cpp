@@ -0,0 +1,361 @@
+/*
+ *  Copyright © 2017-2020 Wellington Wallace
+ *
+ *  This file is part of PulseEffects.
+ *
+ *  PulseEffects is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  PulseEffects is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with PulseEffects.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "loudness_analyzer.hpp"
+#include <pthread.h>
+#include <sched.h>
+#include <algorithm>
+#include <chrono>
+
+LoudnessAnalyzer::LoudnessAnalyzer(const std::string& tag, const std::vector<uint>& values, const uint& max_history)
+    : log_tag(tag), max_history_ms(max_history) {
+  for (const auto& v : values) {
+    taps.emplace_back(std::make_unique<Tap>());
+
+    taps.back()->values = v;
+  }
+}
+
+LoudnessAnalyzer::~LoudnessAnalyzer() {
+  {
+    std::lock_guard<std::mutex> lock(analyzer_mutex);
+
+    analyzer_quit = true;
+  }
+
+  analyzer_cv.notify_one();
+
+  if (analyzer.joinable()) {
+    analyzer.join();
+  }
+
+  for (auto& tap : taps) {
+    if (tap->state != nullptr) {
+      ebur128_destroy(&tap->state);
+    }
+  }
+}
+
+void LoudnessAnalyzer::set_rate(const int& value) {
+  if (value == rate) {
+    return;
+  }
+
+  rate = value;
+
+  analysis_rate.store(rate);
+
+  if (!analyzer.joinable()) {
+    analyzer = std::thread(&LoudnessAnalyzer::analyze, this);
+  }
+
+  util::debug(log_tag + "loudness measured at " + std::to_string(rate) + " Hz");
+}
+
+void LoudnessAnalyzer::push(const uint& tap, const float* data, const uint& nsamples) {
+  Tap& t = *taps[tap];
+
+  uint w = t.write_pos.load(std::memory_order_relaxed);
+  uint r = t.read_pos.load(std::memory_order_acquire);
+
+  uint nframes = std::min(nsamples, ring_size - (w - r));
+
+  if (nframes < nsamples) {
+    t.dropped.fetch_add(nsamples - nframes, std::memory_order_relaxed);
+  }
+
+  // the ring may wrap around in the middle of the frames
+
+  uint start = w & (ring_size - 1U);
+  uint first = std::min(nframes, ring_size - start);
+
+  std::copy(data, data + 2U * first, t.data.begin() + 2U * start);
+  std::copy(data + 2U * first, data + 2U * nframes, t.data.begin());
+
+  t.write_pos.store(w + nframes, std::memory_order_release);
+}
+
+auto LoudnessAnalyzer::try_snapshot(const uint& tap, LoudnessSnapshot& output) -> bool {
+  Tap& t = *taps[tap];
+  LoudnessSnapshot s;
+
+  uint seq0 = t.seq.load(std::memory_order_acquire);
+
+  if ((seq0 & 1U) != 0U) {
+    return false;
+  }
+
+  s.momentary = t.momentary.load(std::memory_order_relaxed);
+  s.shortterm = t.shortterm.load(std::memory_order_relaxed);
+  s.global = t.global.load(std::memory_order_relaxed);
+  s.relative = t.relative.load(std::memory_order_relaxed);
+  s.range = t.range.load(std::memory_order_relaxed);
+  s.blocks = t.blocks.load(std::memory_order_relaxed);
+  s.generation = t.generation.load(std::memory_order_relaxed);
+  s.valid = t.valid.load(std::memory_order_relaxed);
+
+  std::atomic_thread_fence(std::memory_order_acquire);
+
+  if (t.seq.load(std::memory_order_relaxed) != seq0) {
+    return false;
+  }
+
+  output = s;
+
+  return true;
+}
+
+auto LoudnessAnalyzer::snapshot(const uint& tap) -> LoudnessSnapshot {
+  LoudnessSnapshot s;
+
+  while (!try_snapshot(tap, s)) {
+    std::this_thread::yield();
+  }
+
+  return s;
+}
+
+auto LoudnessAnalyzer::reset(const uint& tap) -> uint {
+  Tap& t = *taps[tap];
+
+  // it has to be visible before the new generation
+
+  t.reset_pos.store(t.write_pos.load(std::memory_order_relaxed), std::memory_order_relaxed);
+
+  return t.requested_generation.fetch_add(1U) + 1U;
+}
+
+void LoudnessAnalyzer::publish(Tap& tap, const LoudnessSnapshot& s) {
+  uint seq = tap.seq.load(std::memory_order_relaxed);
+
+  tap.seq.store(seq + 1U, std::memory_order_relaxed);
+
+  std::atomic_thread_fence(std::memory_order_release);
+
+  tap.momentary.store(s.momentary, std::memory_order_relaxed);
+  tap.shortterm.store(s.shortterm, std::memory_order_relaxed);
+  tap.global.store(s.global, std::memory_order_relaxed);
+  tap.relative.store(s.relative, std::memory_order_relaxed);
+  tap.range.store(s.range, std::memory_order_relaxed);
+  tap.blocks.store(s.blocks, std::memory_order_relaxed);
+  tap.generation.store(s.generation, std::memory_order_relaxed);
+  tap.valid.store(s.valid, std::memory_order_relaxed);
+
+  tap.seq.store(seq + 2U, std::memory_order_release);
+}
+
+auto LoudnessAnalyzer::create_state(const uint& values, const int& rate) const -> ebur128_state* {
+  int mode = EBUR128_MODE_M | EBUR128_MODE_HISTOGRAM;
+
+  if ((values & shortterm) != 0U) {
+    mode |= EBUR128_MODE_S;
+  }
+
+  if ((values & integrated) != 0U) {
+    mode |= EBUR128_MODE_I;
+  }
+
+  if ((values & range) != 0U) {
+    mode |= EBUR128_MODE_LRA;
+  }
+
+  auto* state = ebur128_init(2U, rate, mode);
+
+  if (state != nullptr) {
+    ebur128_set_channel(state, 0U, EBUR128_LEFT);
+    ebur128_set_channel(state, 1U, EBUR128_RIGHT);
+
+    if (max_history_ms > 0U) {
+      ebur128_set_max_history(state, max_history_ms);
+    }
+  }
+
+  return state;
+}
+
+auto LoudnessAnalyzer::drain(Tap& tap, ebur128_state* state, std::vector<float>& buffer) -> uint {
+  uint r = tap.read_pos.load(std::memory_order_relaxed);
+  uint w = tap.write_pos.load(std::memory_order_acquire);
+
+  if (w == r) {
+    return 0U;
+  }
+
+  uint nframes = w - r;
+
+  buffer.resize(2U * nframes);
+
+  uint start = r & (ring_size - 1U);
+  uint first = std::min(nframes, ring_size - start);
+
+  std::copy(tap.data.begin() + 2U * start, tap.data.begin() + 2U * (start + first), buffer.begin());
+  std::copy(tap.data.begin(), tap.data.begin() + 2U * (nframes - first), buffer.begin() + 2U * first);
+
+  tap.read_pos.store(w, std::memory_order_release);
+
+  if (state == nullptr) {
+    return 0U;
+  }
+
+  ebur128_add_frames_float(state, buffer.data(), nframes);
+
+  return nframes;
+}
+
+void LoudnessAnalyzer::measure(Tap& tap, const int& current_rate, std::vector<float>& buffer) {
+  LoudnessSnapshot s;
+
+  s.generation = tap.requested_generation.load();
+
+  if (tap.state == nullptr || s.generation != tap.generation.load(std::memory_order_relaxed)) {
+    if (tap.state != nullptr) {
+      ebur128_destroy(&tap.state);
+    }
+
+    tap.state = create_state(tap.values, current_rate);
+    tap.gated_frames = 0U;
+
+    // the frames pushed before the reset are skipped. The ones after it may already be in the ring
+
+    uint r = tap.read_pos.load(std::memory_order_relaxed);
+    uint w = tap.write_pos.load(std::memory_order_acquire);
+    uint skip = tap.reset_pos.load(std::memory_order_relaxed) - r;
+
+    if (skip <= w - r) {
+      tap.read_pos.store(r + skip, std::memory_order_release);
+    }
+  }
+
+  uint lost = tap.dropped.exchange(0U, std::memory_order_relaxed);
+
+  // a burst of dropped frames is reported once. It ends in the first round without losses
+
+  if (lost > 0U && !tap.dropping) {
+    util::warning(log_tag + "the loudness analysis fell behind. " + std::to_string(lost) + " frames were dropped");
+  } else if (lost == 0U && tap.dropping) {
+    util::debug(log_tag + "the loudness analysis caught up. " + std::to_string(tap.burst_frames) +
+                " frames were dropped in total");
+  }
+
+  tap.burst_frames = (tap.dropping ? tap.burst_frames : 0U) + lost;
+  tap.dropping = lost > 0U;
+
+  uint nframes = drain(tap, tap.state, buffer);
+
+  if (nframes == 0U) {
+    if (s.generation != tap.generation.load(std::memory_order_relaxed)) {
+      publish(tap, s);
+    }
+
+    return;
+  }
+
+  double v = 0.0;
+  bool failed = false;
+
+  if ((tap.values & momentary) != 0U) {
+    failed |= ebur128_loudness_momentary(tap.state, &v) != EBUR128_SUCCESS;
+    s.momentary = static_cast<float>(v);
+
+    // the blocks above the absolute gate
+
+    if (s.momentary > -70.0F) {
+      tap.gated_frames += nframes;
+    }
+  }
+
+  if ((tap.values & shortterm) != 0U) {
+    failed |= ebur128_loudness_shortterm(tap.state, &v) != EBUR128_SUCCESS;
+    s.shortterm = static_cast<float>(v);
+  }
+
+  if ((tap.values & integrated) != 0U) {
+    failed |= ebur128_loudness_global(tap.state, &v) != EBUR128_SUCCESS;
+    s.global = static_cast<float>(v);
+
+    failed |= ebur128_relative_threshold(tap.state, &v) != EBUR128_SUCCESS;
+    s.relative = static_cast<float>(v);
+  }
+
+  if ((tap.values & range) != 0U) {
+    failed |= ebur128_loudness_range(tap.state, &v) != EBUR128_SUCCESS;
+    s.range = static_cast<float>(v);
+  }
+
+  s.blocks = static_cast<uint>(tap.gated_frames / static_cast<uint64_t>(std::max(1, current_rate / 10)));
+  s.valid = !failed && !tap.dropping;
+
+  publish(tap, s);
+}
+
+void LoudnessAnalyzer::analyze() {
+  /*
+    The measurement must not compete with the audio threads for the cpu. SCHED_IDLE is not used because it would
+    starve the thread while any other process is busy and the ring would overflow.
+  */
+
+  sched_param param{};
+
+  if (pthread_setschedparam(pthread_self(), SCHED_BATCH, &param) != 0) {
+    util::debug(log_tag + "could not lower the priority of the loudness thread");
+  }
+
+  int current_rate = 0;
+  std::vector<float> buffer;
+
+  std::unique_lock<std::mutex> lock(analyzer_mutex);
+
+  while (!analyzer_quit) {
+    analyzer_cv.wait_for(lock, std::chrono::milliseconds(100), [&] { return analyzer_quit; });
+
+    if (analyzer_quit) {
+      break;
+    }
+
+    lock.unlock();
+
+    int new_rate = analysis_rate.load();
+
+    if (new_rate != current_rate) {
+      current_rate = new_rate;
+
+      // what was pushed before the change has the old rate
+
+      for (auto& tap : taps) {
+        if (tap->state != nullptr) {
+          ebur128_destroy(&tap->state);
+        }
+
+        drain(*tap, nullptr, buffer);
+
+        LoudnessSnapshot s;
+
+        s.generation = tap->generation.load(std::memory_order_relaxed);
+
+        publish(*tap, s);
+      }
+    }
+
+    for (auto& tap : taps) {
+      measure(*tap, current_rate, buffer);
+    }
+
+    lock.lock();
+  }
+}
@@ -20,7 +20,9 @@
 /**
  * SECTION:element-gstpernnoise
  *
- * The pernnoise uses the rnnoise library to remove background noise from audio.
+ * The pernnoise uses the rnnoise library to remove background noise from audio. It accepts any sampling rate and
+ * buffer size. The frames are resampled to 48 kHz when needed and grouped in the blocks of 480 frames rnnoise works
+ * with.
  *
  * <refsect2>
  * <title>Example launch line</title>
@@ -34,13 +36,15 @@
 #include "gstpernnoise.hpp"
 #include <gst/audio/gstaudiofilter.h>
 #include <gst/gst.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
 #include <cstring>
 #include <mutex>
 #include "config.h"
+#include "model_cache.hpp"
 #include "util.hpp"
 
-std::mutex rnnoise_mutex;
-
 GST_DEBUG_CATEGORY_STATIC(gst_pernnoise_debug_category);
 #define GST_CAT_DEFAULT gst_pernnoise_debug_category
 
@@ -58,6 +62,8 @@ static auto gst_pernnoise_transform_ip(GstBaseTransform* trans, GstBuffer* buffe
 
 static auto gst_pernnoise_stop(GstBaseTransform* base) -> gboolean;
 
+static auto gst_pernnoise_query(GstBaseTransform* trans, GstPadDirection direction, GstQuery* query) -> gboolean;
+
 static void gst_pernnoise_set_model_path(GstPernnoise* pernnoise, gchar* value);
 
 static void gst_pernnoise_process(GstPernnoise* pernnoise, GstBuffer* buffer);
@@ -66,6 +72,27 @@ static void gst_pernnoise_setup_rnnoise(GstPernnoise* pernnoise);
 
 static void gst_pernnoise_finish_rnnoise(GstPernnoise* pernnoise);
 
+static void gst_pernnoise_resample(SRC_STATE* state,
+                                   const double& ratio,
+                                   const float* data,
+                                   const uint& nsamples,
+                                   std::vector<float>& buffer,
+                                   std::vector<float>& output);
+
+static auto gst_pernnoise_held_frames(SRC_STATE* state, const double& ratio) -> double;
+
+static auto gst_pernnoise_measure_latency(const int& rate, const int& blocksize, uint& latency) -> bool;
+
+namespace {
+
+constexpr int rnnoise_rate = 48000;
+
+// the best quality converter costs more than rnnoise itself. The medium one is already transparent for speech
+
+constexpr int resampler_quality = SRC_SINC_MEDIUM_QUALITY;
+
+}  // namespace
+
 enum { PROP_MODEL_PATH = 1 };
 
 /* pad templates */
@@ -123,6 +150,8 @@ static void gst_pernnoise_class_init(GstPernnoiseClass* klass) {
 
   base_transform_class->stop = GST_DEBUG_FUNCPTR(gst_pernnoise_stop);
 
+  base_transform_class->query = GST_DEBUG_FUNCPTR(gst_pernnoise_query);
+
   /* define properties */
 
   g_object_class_install_property(
@@ -136,6 +165,7 @@ static void gst_pernnoise_init(GstPernnoise* pernnoise) {
   pernnoise->ready = false;
   pernnoise->bpf = -1;
   pernnoise->inbuf_n_samples = -1;
+  pernnoise->latency = 0U;
   pernnoise->blocksize = 480;  // for some reason I do not know rnnoise has to process buffers of 480 elements
 
   pernnoise->data_L.resize(pernnoise->blocksize);
@@ -182,7 +212,7 @@ void gst_pernnoise_finalize(GObject* object) {
 
   GST_DEBUG_OBJECT(pernnoise, "finalize");
 
-  std::lock_guard<std::mutex> guard(rnnoise_mutex);
+  std::lock_guard<std::mutex> guard(pernnoise->lock_guard_rnnoise);
 
   gst_pernnoise_finish_rnnoise(pernnoise);
 
@@ -196,16 +226,34 @@ static auto gst_pernnoise_setup(GstAudioFilter* filter, const GstAudioInfo* info
 
   GST_DEBUG_OBJECT(pernnoise, "setup");
 
-  pernnoise->rate = info->rate;
-  pernnoise->bpf = GST_AUDIO_INFO_BPF(info);
+  uint latency = 0U;
+
+  // rnnoise can only work at other rates through the resamplers
+
+  if (!gst_pernnoise_measure_latency(info->rate, pernnoise->blocksize, latency)) {
+    return 0;
+  }
 
   /*
   this function is called whenever there is a format change. So we reinitialize rnnoise.
   */
 
-  std::lock_guard<std::mutex> guard(rnnoise_mutex);
+  {
+    std::lock_guard<std::mutex> guard(pernnoise->lock_guard_rnnoise);
 
-  gst_pernnoise_finish_rnnoise(pernnoise);
+    gst_pernnoise_finish_rnnoise(pernnoise);
+
+    pernnoise->rate = info->rate;
+    pernnoise->bpf = GST_AUDIO_INFO_BPF(info);
+    pernnoise->latency = latency;
+  }
+
+  util::debug("rnnoise plugin: latency of " + std::to_string(latency) + " frames at " + std::to_string(info->rate) +
+              " Hz");
+
+  // our latency changed
+
+  gst_element_post_message(GST_ELEMENT_CAST(pernnoise), gst_message_new_latency(GST_OBJECT_CAST(pernnoise)));
 
   return 1;
 }
@@ -215,27 +263,58 @@ static auto gst_pernnoise_transform_ip(GstBaseTransform* trans, GstBuffer* buffe
 
   GST_DEBUG_OBJECT(pernnoise, "transform");
 
-  std::lock_guard<std::mutex> guard(rnnoise_mutex);
+  std::lock_guard<std::mutex> guard(pernnoise->lock_guard_rnnoise);
 
-  if (pernnoise->ready) {
-    gst_pernnoise_process(pernnoise, buffer);
-  } else {
+  if (!pernnoise->ready) {
     gst_pernnoise_setup_rnnoise(pernnoise);
   }
 
+  gst_pernnoise_process(pernnoise, buffer);
+
   return GST_FLOW_OK;
 }
 
 static auto gst_pernnoise_stop(GstBaseTransform* base) -> gboolean {
   GstPernnoise* pernnoise = GST_PERNNOISE(base);
 
-  std::lock_guard<std::mutex> guard(rnnoise_mutex);
+  std::lock_guard<std::mutex> guard(pernnoise->lock_guard_rnnoise);
 
   gst_pernnoise_finish_rnnoise(pernnoise);
 
   return 1;
 }
 
+static auto gst_pernnoise_query(GstBaseTransform* trans, GstPadDirection direction, GstQuery* query) -> gboolean {
+  GstPernnoise* pernnoise = GST_PERNNOISE(trans);
+
+  if (direction == GST_PAD_SRC && GST_QUERY_TYPE(query) == GST_QUERY_LATENCY) {
+    gboolean ret = gst_pad_peer_query(GST_BASE_TRANSFORM_SINK_PAD(trans), query);
+
+    if (ret && pernnoise->rate > 0) {
+      gboolean live;
+      GstClockTime min, max;
+
+      gst_query_parse_latency(query, &live, &min, &max);
+
+      /* add our own latency */
+
+      GstClockTime latency = gst_util_uint64_scale_round(pernnoise->latency, GST_SECOND, pernnoise->rate);
+
+      min += latency;
+
+      if (max != GST_CLOCK_TIME_NONE) {
+        max += latency;
+      }
+
+      gst_query_set_latency(query, live, min, max);
+    }
+
+    return ret;
+  }
+
+  return GST_BASE_TRANSFORM_CLASS(gst_pernnoise_parent_class)->query(trans, direction, query);
+}
+
 static void gst_pernnoise_set_model_path(GstPernnoise* pernnoise, gchar* value) {
   if (value != nullptr) {
     if (pernnoise->model_path != nullptr) {
@@ -244,7 +323,7 @@ static void gst_pernnoise_set_model_path(GstPernnoise* pernnoise, gchar* value)
 
         pernnoise->model_path = value;
 
-        std::lock_guard<std::mutex> guard(rnnoise_mutex);
+        std::lock_guard<std::mutex> guard(pernnoise->lock_guard_rnnoise);
 
         gst_pernnoise_finish_rnnoise(pernnoise);
       }
@@ -259,20 +338,55 @@ static void gst_pernnoise_set_model_path(GstPernnoise* pernnoise, gchar* value)
 }
 
 static void gst_pernnoise_setup_rnnoise(GstPernnoise* pernnoise) {
-  if (pernnoise->model_path != nullptr) {
-    FILE* f = fopen(pernnoise->model_path, "r");
+  /*
+    rnnoise fills its fft tables the first time a frame is processed and does it without any lock. Processing one
+    frame here, once per process, makes the instances safe to run in parallel.
+  */
+
+  static std::once_flag tables_flag;
 
-    if (f != nullptr) {
-      util::debug("rnnoise plugin: loading model from file: " + std::string(pernnoise->model_path));
+  std::call_once(tables_flag, []() {
+    std::vector<float> frame(480U, 0.0F);
 
-      pernnoise->model = rnnoise_model_from_file(f);
+    DenoiseState* st = rnnoise_create(nullptr);
+
+    rnnoise_process_frame(st, frame.data(), frame.data());
+
+    rnnoise_destroy(st);
+  });
+
+  if (pernnoise->model_path != nullptr && std::strlen(pernnoise->model_path) > 0U) {
+    pernnoise->model = model_cache::get(pernnoise->model_path);
+  }
 
-      fclose(f);
+  pernnoise->state_left = rnnoise_create(pernnoise->model.get());
+  pernnoise->state_right = rnnoise_create(pernnoise->model.get());
+
+  if (pernnoise->rate != rnnoise_rate) {
+    int error = 0;
+
+    pernnoise->resampler_in = src_new(resampler_quality, 2, &error);
+    pernnoise->resampler_out = src_new(resampler_quality, 2, &error);
+
+    if (pernnoise->resampler_in == nullptr || pernnoise->resampler_out == nullptr) {
+      util::warning("rnnoise plugin: could not create the resamplers: " + std::string(src_strerror(error)) +
+                    ". The audio is passed through");
     }
   }
 
-  pernnoise->state_left = rnnoise_create(pernnoise->model);
-  pernnoise->state_right = rnnoise_create(pernnoise->model);
+  /*
+    The output fifo starts with as many zeros as the frames the resamplers and the 480 frames blocks can hold back.
+    So it never runs dry and a frame always leaves the element exactly latency frames after it arrived.
+  */
+
+  pernnoise->fifo_in.clear();
+  pernnoise->fifo_in.reserve(2U * 8192U);
+
+  pernnoise->fifo_out.assign(2U * pernnoise->latency, 0.0F);
+  pernnoise->fifo_out.reserve(2U * (pernnoise->latency + 8192U));
+
+  pernnoise->block.resize(2U * pernnoise->blocksize);
+  pernnoise->resampled.resize(2U * 1024U);
 
   pernnoise->ready = true;
 }
@@ -284,35 +398,196 @@ static void gst_pernnoise_process(GstPernnoise* pernnoise, GstBuffer* buffer) {
 
   auto* data = reinterpret_cast<float*>(map.data);
 
-  // deinterleave
-  for (int n = 0U; n < pernnoise->blocksize; n++) {
-    pernnoise->data_L[n] = data[2U * n] * (SHRT_MAX + 1);
-    pernnoise->data_R[n] = data[2U * n + 1U] * (SHRT_MAX + 1);
+  uint nsamples = map.size / pernnoise->bpf;
+
+  double ratio = static_cast<double>(rnnoise_rate) / pernnoise->rate;
+
+  bool resample = pernnoise->resampler_in != nullptr && pernnoise->resampler_out != nullptr;
+
+  /*
+    rnnoise can not be given frames at another rate. Without the resamplers the frames go straight to the output
+    fifo. They are still delayed by the latency we reported.
+  */
+
+  if (resample) {
+    gst_pernnoise_resample(pernnoise->resampler_in, ratio, data, nsamples, pernnoise->resampled, pernnoise->fifo_in);
+  } else if (pernnoise->rate == rnnoise_rate) {
+    pernnoise->fifo_in.insert(pernnoise->fifo_in.end(), data, data + 2U * nsamples);
+  } else {
+    pernnoise->fifo_out.insert(pernnoise->fifo_out.end(), data, data + 2U * nsamples);
   }
 
-  rnnoise_process_frame(pernnoise->state_left, pernnoise->data_L.data(), pernnoise->data_L.data());
-  rnnoise_process_frame(pernnoise->state_right, pernnoise->data_R.data(), pernnoise->data_R.data());
+  uint bs = pernnoise->blocksize;
+  uint nblocks = pernnoise->fifo_in.size() / (2U * bs);
 
-  // interleave
-  for (int n = 0U; n < pernnoise->blocksize; n++) {
-    data[2U * n] = pernnoise->data_L[n] / (SHRT_MAX + 1);
-    data[2U * n + 1U] = pernnoise->data_R[n] / (SHRT_MAX + 1);
+  for (uint b = 0U; b < nblocks; b++) {
+    const float* frames = pernnoise->fifo_in.data() + 2U * bs * b;
+
+    // deinterleave
+    for (uint n = 0U; n < bs; n++) {
+      pernnoise->data_L[n] = frames[2U * n] * (SHRT_MAX + 1);
+      pernnoise->data_R[n] = frames[2U * n + 1U] * (SHRT_MAX + 1);
+    }
+
+    rnnoise_process_frame(pernnoise->state_left, pernnoise->data_L.data(), pernnoise->data_L.data());
+    rnnoise_process_frame(pernnoise->state_right, pernnoise->data_R.data(), pernnoise->data_R.data());
+
+    // interleave
+    for (uint n = 0U; n < bs; n++) {
+      pernnoise->block[2U * n] = pernnoise->data_L[n] / (SHRT_MAX + 1);
+      pernnoise->block[2U * n + 1U] = pernnoise->data_R[n] / (SHRT_MAX + 1);
+    }
+
+    if (resample) {
+      gst_pernnoise_resample(pernnoise->resampler_out, 1.0 / ratio, pernnoise->block.data(), bs, pernnoise->resampled,
+                             pernnoise->fifo_out);
+    } else {
+      pernnoise->fifo_out.insert(pernnoise->fifo_out.end(), pernnoise->block.begin(), pernnoise->block.end());
+    }
   }
 
+  pernnoise->fifo_in.erase(pernnoise->fifo_in.begin(), pernnoise->fifo_in.begin() + 2U * bs * nblocks);
+
+  // the prefilled zeros make sure there are always enough frames. The fill is just a safety net
+
+  uint navailable = std::min(nsamples, static_cast<uint>(pernnoise->fifo_out.size() / 2U));
+
+  std::copy(pernnoise->fifo_out.begin(), pernnoise->fifo_out.begin() + 2U * navailable, data);
+  std::fill(data + 2U * navailable, data + 2U * nsamples, 0.0F);
+
+  pernnoise->fifo_out.erase(pernnoise->fifo_out.begin(), pernnoise->fifo_out.begin() + 2U * navailable);
+
   gst_buffer_unmap(buffer, &map);
 }
 
+/*
+  Appends to output the frames libsamplerate can give for the nsamples interleaved stereo frames in data. It may
+  need more than one call when the buffer is smaller than the output.
+*/
+
+static void gst_pernnoise_resample(SRC_STATE* state,
+                                   const double& ratio,
+                                   const float* data,
+                                   const uint& nsamples,
+                                   std::vector<float>& buffer,
+                                   std::vector<float>& output) {
+  SRC_DATA src_data{};
+
+  src_data.data_in = data;
+  src_data.input_frames = nsamples;
+  src_data.src_ratio = ratio;
+  src_data.end_of_input = 0;
+
+  while (src_data.input_frames > 0) {
+    src_data.data_out = buffer.data();
+    src_data.output_frames = buffer.size() / 2U;
+
+    if (src_process(state, &src_data) != 0) {
+      break;
+    }
+
+    output.insert(output.end(), buffer.begin(), buffer.begin() + 2U * src_data.output_frames_gen);
+
+    if (src_data.input_frames_used == 0 && src_data.output_frames_gen == 0) {
+      break;
+    }
+
+    src_data.data_in += 2U * src_data.input_frames_used;
+    src_data.input_frames -= src_data.input_frames_used;
+  }
+}
+
+/*
+  Frames, at the rate of its input, that a converter holds back once it is running. It is given one large block of
+  silence and whatever did not come out is still inside it. libsamplerate gives the same frames no matter how the
+  input is split, so this does not depend on the size of the buffers seen while playing.
+*/
+
+static auto gst_pernnoise_held_frames(SRC_STATE* state, const double& ratio) -> double {
+  constexpr uint probe_size = 16384U;
+
+  std::vector<float> silence(2U * probe_size, 0.0F), buffer(2U * 1024U), output;
+
+  output.reserve(2U * static_cast<uint>(probe_size * ratio + 1024U));
+
+  gst_pernnoise_resample(state, ratio, silence.data(), probe_size, buffer, output);
+
+  return static_cast<double>(probe_size) - static_cast<double>(output.size() / 2U) / ratio;
+}
+
+/*
+  The latency is the largest number of frames the element holds back at any moment. At 48 kHz that is just an
+  incomplete block. Otherwise the input converter, an incomplete block at 48 kHz and the output converter add up.
+  The sum of their largest values is never exceeded. It returns false when the converters can not be created.
+*/
+
+static auto gst_pernnoise_measure_latency(const int& rate, const int& blocksize, uint& latency) -> bool {
+  if (rate == rnnoise_rate) {
+    latency = blocksize - 1U;
+
+    return true;
+  }
+
+  int error = 0;
+
+  SRC_STATE* state_in = src_new(resampler_quality, 2, &error);
+  SRC_STATE* state_out = src_new(resampler_quality, 2, &error);
+
+  bool ok = state_in != nullptr && state_out != nullptr;
+
+  if (ok) {
+    double ratio = static_cast<double>(rnnoise_rate) / rate;
+
+    double held_in = gst_pernnoise_held_frames(state_in, ratio);
+    double held_out = gst_pernnoise_held_frames(state_out, 1.0 / ratio) / ratio;
+    double incomplete_block = (blocksize - 1U) / ratio;
+
+    // a few frames against the fractional position of the converters and the rounding of the buffer splits
+
+    latency = static_cast<uint>(std::ceil(held_in + incomplete_block + held_out)) + 4U;
+  } else {
+    util::warning("rnnoise plugin: could not create the resamplers: " + std::string(src_strerror(error)));
+  }
+
+  if (state_in != nullptr) {
+    src_delete(state_in);
+  }
+
+  if (state_out != nullptr) {
+    src_delete(state_out);
+  }
+
+  return ok;
+}
+
 static void gst_pernnoise_finish_rnnoise(GstPernnoise* pernnoise) {
   if (pernnoise->ready) {
     pernnoise->ready = false;
 
     rnnoise_destroy(pernnoise->state_left);
     rnnoise_destroy(pernnoise->state_right);
-    rnnoise_model_free(pernnoise->model);
 
     pernnoise->state_left = nullptr;
     pernnoise->state_right = nullptr;
-    pernnoise->model = nullptr;
+
+    if (pernnoise->resampler_in != nullptr) {
+      src_delete(pernnoise->resampler_in);
+
+      pernnoise->resampler_in = nullptr;
+    }
+
+    if (pernnoise->resampler_out != nullptr) {
+      src_delete(pernnoise->resampler_out);
+
+      pernnoise->resampler_out = nullptr;
+    }
+
+    pernnoise->fifo_in.clear();
+    pernnoise->fifo_out.clear();
+
+    // the model is freed by the cache when no other instance uses it
+
+    pernnoise->model.reset();
   }
 }
 
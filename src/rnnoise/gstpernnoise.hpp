@@ -21,9 +21,11 @@
 #define GST_PERNNOISE_HPP
 
 #include <gst/audio/gstaudiofilter.h>
+#include <rnnoise.h>
+#include <samplerate.h>
+#include <memory>
 #include <mutex>
 #include <vector>
-#include <rnnoise.h>
 
 G_BEGIN_DECLS
 
@@ -47,14 +49,29 @@ struct GstPernnoise {
   int inbuf_n_samples;   // number of samples in the input buffer
   int outbuf_n_samples;  // number of samples in the input buffer
   int blocksize;         // number of samples processed by the rnnoise library
+  uint latency;          // frames at our rate between a frame entering the element and leaving it
   bool flag_discont;
   bool ready;
 
-  RNNModel* model = nullptr;
+  std::shared_ptr<RNNModel> model;  // read only. Shared with the other instances that use the same file
   DenoiseState *state_left = nullptr, *state_right = nullptr;
 
+  std::mutex lock_guard_rnnoise;  // only contended when the model or the format changes
+
   std::vector<float> data_L;  // left channel buffer
   std::vector<float> data_R;  // right channel buffer
+
+  /*
+    rnnoise only works at 48 kHz. At other rates the frames are resampled to 48 kHz before the fifo_in and back to
+    our rate after the denoising. Both resamplers are null at 48 kHz.
+  */
+
+  SRC_STATE *resampler_in = nullptr, *resampler_out = nullptr;
+
+  std::vector<float> fifo_in;    // interleaved 48 kHz frames waiting for a complete block
+  std::vector<float> fifo_out;   // interleaved frames at our rate waiting to leave. It starts with latency zeros
+  std::vector<float> block;      // interleaved denoised block
+  std::vector<float> resampled;  // output buffer of the resamplers
 };
 
 struct GstPernnoiseClass {
@@ -0,0 +1,97 @@
+/*
+ *  Copyright © 2017-2020 Wellington Wallace
+ *
+ *  This file is part of PulseEffects.
+ *
+ *  PulseEffects is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  PulseEffects is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with PulseEffects.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef MODEL_CACHE_HPP
+#define MODEL_CACHE_HPP
+
+#include <rnnoise.h>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include "util.hpp"
+
+/*
+  rnnoise only reads the model while denoising. So all the pernnoise instances in the process that use the same
+  model file share one copy of it. The cache holds weak references: the model is freed when the last instance that
+  uses it lets it go and parsed again the next time it is needed.
+*/
+
+namespace model_cache {
+
+inline auto mutex() -> std::mutex& {
+  static std::mutex m;
+
+  return m;
+}
+
+inline auto models() -> std::map<std::string, std::weak_ptr<RNNModel>>& {
+  static std::map<std::string, std::weak_ptr<RNNModel>> entries;
+
+  return entries;
+}
+
+// an empty pointer means the file could not be read. rnnoise then uses its built-in model
+
+inline auto get(const std::string& path) -> std::shared_ptr<RNNModel> {
+  std::lock_guard<std::mutex> lock(mutex());
+
+  auto& entries = models();
+
+  auto it = entries.find(path);
+
+  if (it != entries.end()) {
+    if (auto model = it->second.lock()) {
+      return model;
+    }
+
+    entries.erase(it);
+  }
+
+  FILE* f = fopen(path.c_str(), "r");
+
+  if (f == nullptr) {
+    util::warning("rnnoise plugin: could not open the model file: " + path);
+
+    return nullptr;
+  }
+
+  util::debug("rnnoise plugin: loading model from file: " + path);
+
+  RNNModel* raw = rnnoise_model_from_file(f);
+
+  fclose(f);
+
+  if (raw == nullptr) {
+    util::warning("rnnoise plugin: could not parse the model file: " + path);
+
+    return nullptr;
+  }
+
+  std::shared_ptr<RNNModel> model(raw, [](RNNModel* m) { rnnoise_model_free(m); });
+
+  entries[path] = model;
+
+  return model;
+}
+
+}  // namespace model_cache
+
+#endif
@@ -41,6 +41,10 @@ void on_message_element(const GstBus* gst_bus, GstMessage* message, StreamInputE
     sie->webrtc_input_level.emit(StreamInputEffects::get_peak(message));
   } else if (std::strcmp(src_name, "webrtc_output_level") == 0) {
     sie->webrtc_output_level.emit(StreamInputEffects::get_peak(message));
+  } else if (std::strcmp(src_name, "autogain_input_level") == 0) {
+    sie->autogain_input_level.emit(StreamInputEffects::get_peak(message));
+  } else if (std::strcmp(src_name, "autogain_output_level") == 0) {
+    sie->autogain_output_level.emit(StreamInputEffects::get_peak(message));
   } else if (std::strcmp(src_name, "deesser_input_level") == 0) {
     sie->deesser_input_level.emit(StreamInputEffects::get_peak(message));
   } else if (std::strcmp(src_name, "deesser_output_level") == 0) {
@@ -186,7 +190,12 @@ StreamInputEffects::StreamInputEffects(PipeManager* pipe_manager) : PipelineBase
   rnnoise = std::make_unique<RNNoise>(log_tag, "com.github.wwmm.pulseeffects.rnnoise",
                                       "/com/github/wwmm/pulseeffects/sourceoutputs/rnnoise/");
 
-  rnnoise->set_caps_out(sampling_rate);
+  autogain = std::make_unique<AutoGain>(log_tag, "com.github.wwmm.pulseeffects.autogain",
+                                        "/com/github/wwmm/pulseeffects/sourceoutputs/autogain/");
+
+  // doing some plugin configurations
+
+  update_autogain_history_id();
 
   plugins.insert(std::make_pair(limiter->name, limiter->plugin));
   plugins.insert(std::make_pair(compressor->name, compressor->plugin));
@@ -202,6 +211,7 @@ StreamInputEffects::StreamInputEffects(PipeManager* pipe_manager) : PipelineBase
   plugins.insert(std::make_pair(stereo_tools->name, stereo_tools->plugin));
   plugins.insert(std::make_pair(maximizer->name, maximizer->plugin));
   plugins.insert(std::make_pair(rnnoise->name, rnnoise->plugin));
+  plugins.insert(std::make_pair(autogain->name, autogain->plugin));
 
   add_plugins_to_pipeline();
 
@@ -270,13 +280,13 @@ void StreamInputEffects::on_source_changed(const NodeInfo& node_info) {
   auto id = get_input_node_id();
 
   if (node_info.id == id) {
+    update_autogain_history_id();
+
     if (node_info.rate != sampling_rate && node_info.rate != 0) {
       gst_element_set_state(pipeline, GST_STATE_NULL);
 
       set_sampling_rate(node_info.rate);
 
-      rnnoise->set_caps_out(sampling_rate);
-
       update_pipeline_state();
     }
   }
@@ -291,11 +301,23 @@ void StreamInputEffects::change_input_device(const NodeInfo& node) {
 
   set_input_node_id(node.id);
 
-  rnnoise->set_caps_out(sampling_rate);
+  update_autogain_history_id();
 
   update_pipeline_state();
 }
 
+void StreamInputEffects::update_autogain_history_id() {
+  auto id = get_input_node_id();
+
+  for (const auto& node : pm->list_nodes) {
+    if (node.id == id) {
+      autogain->set_history_id(node.name);
+
+      break;
+    }
+  }
+}
+
 void StreamInputEffects::add_plugins_to_pipeline() {
   gchar* name = nullptr;
   GVariantIter* iter = nullptr;
@@ -41,6 +41,7 @@ StreamInputEffectsUi::StreamInputEffectsUi(BaseObjectType* cobject,
   auto b_stereo_tools = Gtk::Builder::create_from_resource("/com/github/wwmm/pulseeffects/ui/stereo_tools.glade");
   auto b_maximizer = Gtk::Builder::create_from_resource("/com/github/wwmm/pulseeffects/ui/maximizer.glade");
   auto b_rnnoise = Gtk::Builder::create_from_resource("/com/github/wwmm/pulseeffects/ui/rnnoise.glade");
+  auto b_autogain = Gtk::Builder::create_from_resource("/com/github/wwmm/pulseeffects/ui/autogain.glade");
 
   b_limiter->get_widget_derived("widgets_grid", limiter_ui, "com.github.wwmm.pulseeffects.limiter",
                                 "/com/github/wwmm/pulseeffects/sourceoutputs/limiter/");
@@ -88,6 +89,9 @@ StreamInputEffectsUi::StreamInputEffectsUi(BaseObjectType* cobject,
   b_rnnoise->get_widget_derived("widgets_grid", rnnoise_ui, "com.github.wwmm.pulseeffects.rnnoise",
                                 "/com/github/wwmm/pulseeffects/sourceoutputs/rnnoise/");
 
+  b_autogain->get_widget_derived("widgets_grid", autogain_ui, "com.github.wwmm.pulseeffects.autogain",
+                                 "/com/github/wwmm/pulseeffects/sourceoutputs/autogain/");
+
   // add to stack
 
   stack->add(*limiter_ui, limiter_ui->name);
@@ -104,6 +108,7 @@ StreamInputEffectsUi::StreamInputEffectsUi(BaseObjectType* cobject,
   stack->add(*stereo_tools_ui, stereo_tools_ui->name);
   stack->add(*maximizer_ui, maximizer_ui->name);
   stack->add(*rnnoise_ui, rnnoise_ui->name);
+  stack->add(*autogain_ui, autogain_ui->name);
 
   // populate listbox
 
@@ -121,6 +126,7 @@ StreamInputEffectsUi::StreamInputEffectsUi(BaseObjectType* cobject,
   add_to_listbox(stereo_tools_ui);
   add_to_listbox(maximizer_ui);
   add_to_listbox(rnnoise_ui);
+  add_to_listbox(autogain_ui);
 
   // show only mic icon before "Application" label
 
@@ -347,6 +353,23 @@ void StreamInputEffectsUi::level_meters_connections() {
       sie->rnnoise_input_level.connect(sigc::mem_fun(*rnnoise_ui, &RNNoiseUi::on_new_input_level_db)));
   connections.emplace_back(
       sie->rnnoise_output_level.connect(sigc::mem_fun(*rnnoise_ui, &RNNoiseUi::on_new_output_level_db)));
+
+  // autogain level meters connections
+
+  connections.emplace_back(
+      sie->autogain_input_level.connect(sigc::mem_fun(*autogain_ui, &AutoGainUi::on_new_input_level_db)));
+  connections.emplace_back(
+      sie->autogain_output_level.connect(sigc::mem_fun(*autogain_ui, &AutoGainUi::on_new_output_level_db)));
+  connections.emplace_back(
+      sie->autogain->momentary.connect(sigc::mem_fun(*autogain_ui, &AutoGainUi::on_new_momentary)));
+  connections.emplace_back(
+      sie->autogain->shortterm.connect(sigc::mem_fun(*autogain_ui, &AutoGainUi::on_new_shortterm)));
+  connections.emplace_back(
+      sie->autogain->integrated.connect(sigc::mem_fun(*autogain_ui, &AutoGainUi::on_new_integrated)));
+  connections.emplace_back(sie->autogain->relative.connect(sigc::mem_fun(*autogain_ui, &AutoGainUi::on_new_relative)));
+  connections.emplace_back(sie->autogain->loudness.connect(sigc::mem_fun(*autogain_ui, &AutoGainUi::on_new_loudness)));
+  connections.emplace_back(sie->autogain->range.connect(sigc::mem_fun(*autogain_ui, &AutoGainUi::on_new_range)));
+  connections.emplace_back(sie->autogain->gain.connect(sigc::mem_fun(*autogain_ui, &AutoGainUi::on_new_gain)));
 }
 
 void StreamInputEffectsUi::up_down_connections() {
@@ -426,4 +449,7 @@ void StreamInputEffectsUi::up_down_connections() {
 
   connections.emplace_back(rnnoise_ui->plugin_up->signal_clicked().connect([=]() { on_up(rnnoise_ui); }));
   connections.emplace_back(rnnoise_ui->plugin_down->signal_clicked().connect([=]() { on_down(rnnoise_ui); }));
+
+  connections.emplace_back(autogain_ui->plugin_up->signal_clicked().connect([=]() { on_up(autogain_ui); }));
+  connections.emplace_back(autogain_ui->plugin_down->signal_clicked().connect([=]() { on_down(autogain_ui); }));
 }
@@ -247,9 +247,7 @@ StreamOutputEffects::StreamOutputEffects(PipeManager* pipe_manager) : PipelineBa
 
   // doing some plugin configurations
 
-  rnnoise->set_caps_out(sampling_rate);
-
-  g_object_set(convolver->adapter, "blocksize", 512, nullptr);
+  update_autogain_history_id();
 
   g_object_set(crystalizer->adapter, "blocksize", 512, nullptr);
 
@@ -347,8 +345,6 @@ void StreamOutputEffects::on_sink_changed(const NodeInfo& node_info) {
 
       set_sampling_rate(node_info.rate);
 
-      rnnoise->set_caps_out(sampling_rate);
-
       update_pipeline_state();
     }
   }
@@ -363,11 +359,23 @@ void StreamOutputEffects::change_output_device(const NodeInfo& node) {
 
   set_output_node_id(node.id);
 
-  rnnoise->set_caps_out(sampling_rate);
+  update_autogain_history_id();
 
   update_pipeline_state();
 }
 
+void StreamOutputEffects::update_autogain_history_id() {
+  auto id = get_output_node_id();
+
+  for (const auto& node : pm->list_nodes) {
+    if (node.id == id) {
+      autogain->set_history_id(node.name);
+
+      break;
+    }
+  }
+}
+
 void StreamOutputEffects::add_plugins_to_pipeline() {
   gchar* name = nullptr;
   GVariantIter* iter = nullptr;